@@ -0,0 +1,123 @@
+#include "assets.hpp"
+#include <stdint.h>
+#include <string.h>
+#include "Arduino.h"
+#include <FS.h>
+#include "trace.hpp"
+
+static asset assets[ASSETS_MAX];
+static int nassets = 0;
+
+static const char *assets_type(const char *path) {
+  const char *dot = strrchr(path, '.');
+  if (!dot) return "text/plain";
+  if (!strcmp(dot, ".html")) return "text/html";
+  if (!strcmp(dot, ".css")) return "text/css";
+  if (!strcmp(dot, ".js")) return "application/javascript";
+  return "text/plain";
+}
+
+static bool ends_with(const char *s, const char *tail) {
+  size_t n = strlen(s), t = strlen(tail);
+  return n >= t && !strcmp(s + n - t, tail);
+}
+
+static asset *assets_slot(const char *path) {
+  for (int i = 0; i < nassets; i++) {
+    if (!strcmp(assets[i].path, path)) {
+      return &assets[i];
+    }
+  }
+  if (nassets == ASSETS_MAX || strlen(path) >= ASSET_PATH_LEN) {
+    TRACE_ERROR(TR_NOASSET, nassets, strlen(path));
+    return NULL;
+  }
+  asset *a = &assets[nassets++];
+  memset(a, 0, sizeof(*a));
+  strcpy(a->path, path);
+  a->type = assets_type(path);
+  return a;
+}
+
+// strong validators. a .gz has the crc32 and length of the original in
+// its last 8 bytes, which stand for the plain file too. anything without
+// one gets its contents fnv-1a hashed, once, here
+static void assets_etag(asset *a) {
+  char name[ASSET_PATH_LEN + 3];
+  uint32_t sum = 2166136261u, len = a->size;
+  if (a->gzsize >= 18) {
+    strcpy(name, a->path);
+    strcat(name, ".gz");
+    File f = SPIFFS.open(name, "r");
+    uint8_t tail[8];
+    f.seek(a->gzsize - 8, SeekSet);
+    f.read(tail, sizeof(tail));
+    f.close();
+    sum = tail[0] | tail[1] << 8 | (uint32_t)tail[2] << 16 | (uint32_t)tail[3] << 24;
+    len = tail[4] | tail[5] << 8 | (uint32_t)tail[6] << 16 | (uint32_t)tail[7] << 24;
+  } else if (a->plain) {
+    File f = SPIFFS.open(a->path, "r");
+    uint8_t buf[256];
+    int got;
+    while ((got = f.read(buf, sizeof(buf))) > 0) {
+      for (int i = 0; i < got; i++) {
+        sum = (sum ^ buf[i]) * 16777619u;
+      }
+    }
+    f.close();
+  }
+  snprintf(a->etag, sizeof(a->etag), "\"%08lx-%lx\"", (unsigned long)sum, (unsigned long)len);
+  snprintf(a->gzetag, sizeof(a->gzetag), "\"%08lx-%lx-gz\"", (unsigned long)sum, (unsigned long)len);
+}
+
+void assets_scan(void) {
+  nassets = 0;
+  Dir dir = SPIFFS.openDir("/");
+  while (dir.next()) {
+    char path[ASSET_PATH_LEN + 3];
+    String name = dir.fileName();
+    if (name.length() >= sizeof(path) || ends_with(name.c_str(), ".bin")) {
+      continue;
+    }
+    strcpy(path, name.c_str());
+    bool gz = ends_with(path, ".gz");
+    if (gz) {
+      path[strlen(path) - 3] = '\0';
+    }
+    asset *a = assets_slot(path);
+    if (!a) {
+      continue;
+    }
+    if (gz) {
+      a->gzsize = dir.fileSize();
+    } else {
+      a->plain = true;
+      a->size = dir.fileSize();
+    }
+  }
+  for (int i = 0; i < nassets; i++) {
+    assets_etag(&assets[i]);
+  }
+}
+
+// "/" is index.html, same as always
+const asset *assets_find(const char *path) {
+  char name[ASSET_PATH_LEN];
+  if (ends_with(path, "/")) {
+    if (strlen(path) + 10 >= sizeof(name)) {
+      return NULL;
+    }
+    snprintf(name, sizeof(name), "%sindex.html", path);
+    path = name;
+  }
+  for (int i = 0; i < nassets; i++) {
+    if (!strcmp(assets[i].path, path)) {
+      return &assets[i];
+    }
+  }
+  return NULL;
+}
+
+int assets_count(void) {
+  return nassets;
+}
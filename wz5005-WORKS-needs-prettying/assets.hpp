@@ -0,0 +1,29 @@
+#ifndef __ASSETS__
+#define __ASSETS__
+
+#include <stdint.h>
+
+// index of the static files in SPIFFS, built once at boot and again after
+// /deploy, so handleFiles() finds a file, its type, size and etag without
+// asking the filesystem. name.gz is folded into the entry for name. the
+// tlog files (*.bin) change all the time and are left out, /log has them
+
+#define ASSETS_MAX      16
+#define ASSET_PATH_LEN  32          // longest path kept, ".gz" not included
+#define ASSET_ETAG_LEN  24
+
+struct asset {
+  char path[ASSET_PATH_LEN];
+  const char *type;
+  bool plain;                       // path itself is there, not only path.gz
+  uint32_t size;
+  uint32_t gzsize;                  // 0 when there is no .gz
+  char etag[ASSET_ETAG_LEN];
+  char gzetag[ASSET_ETAG_LEN];
+};
+
+void assets_scan(void);
+const asset *assets_find(const char *path);
+int assets_count(void);
+
+#endif
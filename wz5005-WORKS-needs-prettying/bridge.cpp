@@ -0,0 +1,61 @@
+#include "bridge.hpp"
+#include <stdint.h>
+#include "Arduino.h"
+#include <ESP8266WiFi.h>
+#include "dps.hpp"
+#include "settings.h"
+
+using namespace wz5005;
+
+#if BRIDGE_PORT
+static WiFiServer listener(BRIDGE_PORT);
+static WiFiClient client;
+static dps_rx rx;
+static Buffer queue[BRIDGE_QUEUE];
+static uint8_t head = 0;
+static uint8_t count = 0;
+
+void bridge_begin(void) {
+  listener.begin();
+  listener.setNoDelay(true);
+}
+
+void bridge_tick(void) {
+  WiFiClient fresh = listener.accept();
+  if (fresh && client.connected()) {
+    fresh.stop();                   // someone already has the bus
+  } else if (fresh) {
+    client = fresh;
+    client.setNoDelay(true);
+    dps_rx_reset(&rx);
+    count = 0;
+    dps_raw_cancel();               // the last client's reply isnt for this one
+  }
+
+  // only read what there is room for, the rest waits in the tcp window
+  while (client.connected() && count < BRIDGE_QUEUE && client.available() > 0) {
+    // anything but a request would sit at the head of the queue for good
+    if (dps_rx_feed(&rx, (uint8_t)client.read()) && dps_is_request(rx.frame[2])) {
+      queue[(head + count) % BRIDGE_QUEUE] = rx.frame;
+      count++;
+    }
+  }
+  if (count && dps_raw_send(queue[head].data())) {
+    head = (head + 1) % BRIDGE_QUEUE;
+    count--;
+  }
+
+  // a reply for a client that has gone is still taken so the next one
+  // doesnt get it
+  Buffer reply;
+  if (dps_raw_reply(reply.data()) && client.connected()) {
+    client.write(reply.data(), reply.size());
+  }
+}
+#else
+void bridge_begin(void) {
+}
+
+void bridge_tick(void) {
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef __BRIDGE__
+#define __BRIDGE__
+
+#include <stdint.h>
+
+// the psu's serial link on a tcp port, for the host tools that want the
+// frames themselves (setup_uart-wifi_bridge, the sim scripts, pollrate)
+// without flashing a telnet bridge instead of this sketch. one client at
+// a time. frames it sends are checked and go out whole in a bus slot of
+// their own between the poller's, each reply goes back as one write on a
+// socket with nagle off, so a frame is a segment both ways. the bridge
+// never holds more than BRIDGE_QUEUE of its frames, past that tcp pushes
+// back on the sender. bytes that arent a good frame are dropped. there
+// is no login, so it is only built in when settings.h gives BRIDGE_PORT
+
+#define BRIDGE_QUEUE    4           // frames read ahead of the bus
+
+// listen on BRIDGE_PORT and shuttle frames, from loop()
+void bridge_begin(void);
+void bridge_tick(void);
+
+#endif
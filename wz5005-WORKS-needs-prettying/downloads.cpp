@@ -0,0 +1,114 @@
+#include "downloads.hpp"
+#include "prof.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+
+#if DOWNLOADS_MAX
+static download slots[DOWNLOADS_MAX];
+#endif
+static uint8_t buf[DOWNLOAD_CHUNK + 8];   // room for the chunk size line and its \r\n
+
+size_t download_file(download *d, uint8_t *buf, size_t len) {
+  PROF_SCOPE(PROF_FLASH);
+  int got = d->file ? d->file.read(buf, len) : 0;
+  return got > 0 ? got : 0;
+}
+
+// one write of at most room bytes, false when the body is done or the
+// client didnt take it
+static bool download_step(download *d, size_t room) {
+  if (room > DOWNLOAD_CHUNK) {
+    room = DOWNLOAD_CHUNK;
+  }
+  if (!d->chunked) {
+    size_t n = d->fill(d, buf, room);
+    return n && d->client.write(buf, n) == n;
+  }
+  uint8_t *body = buf + 6;
+  size_t n = d->fill(d, body, room - 8);
+  if (!n) {
+    d->client.write("0\r\n\r\n");
+    return false;
+  }
+  char size[8];
+  int len = sprintf(size, "%X\r\n", (unsigned)n);
+  memcpy(body - len, size, len);
+  memcpy(body + n, "\r\n", 2);
+  return d->client.write(body - len, len + n + 2) == len + n + 2;
+}
+
+static void download_end(download *d) {
+  d->file.close();
+  // dropping the last copy closes it without waiting for acks the way
+  // stop() does, lwip still sends whatever is queued
+  d->client = WiFiClient();
+  d->fill = NULL;
+}
+
+void download_start(const download &d) {
+#if DOWNLOADS_MAX
+  for (int i = 0; i < DOWNLOADS_MAX; i++) {
+    if (!slots[i].fill) {
+      slots[i] = d;
+      slots[i].progress = millis();
+      return;
+    }
+  }
+#endif
+  // no slot, write it all now. write() waits for acks as it goes
+  download tmp = d;
+  while (download_step(&tmp, DOWNLOAD_CHUNK)) {
+  }
+  download_end(&tmp);
+}
+
+void downloads_tick(void) {
+#if DOWNLOADS_MAX
+  for (int i = 0; i < DOWNLOADS_MAX; i++) {
+    download *d = &slots[i];
+    if (!d->fill) {
+      continue;
+    }
+    if (!d->client.connected() || millis() - d->progress > DOWNLOAD_STALL) {
+      download_end(d);
+      continue;
+    }
+    size_t room = d->client.availableForWrite();
+    if (room < DOWNLOAD_MIN) {
+      continue;
+    }
+    if (!download_step(d, room)) {
+      download_end(d);
+      continue;
+    }
+    d->progress = millis();
+  }
+#endif
+}
+
+int downloads_active(void) {
+  int n = 0;
+#if DOWNLOADS_MAX
+  for (int i = 0; i < DOWNLOADS_MAX; i++) {
+    if (slots[i].fill) {
+      n++;
+    }
+  }
+#endif
+  return n;
+}
+
+int downloads_using(download_fill fill) {
+  int n = 0;
+#if DOWNLOADS_MAX
+  for (int i = 0; i < DOWNLOADS_MAX; i++) {
+    if (slots[i].fill == fill) {
+      n++;
+    }
+  }
+#endif
+  (void)fill;
+  return n;
+}
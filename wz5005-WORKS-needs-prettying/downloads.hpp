@@ -0,0 +1,49 @@
+#ifndef __DOWNLOADS__
+#define __DOWNLOADS__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ESP8266WiFi.h>
+#include <FS.h>
+
+// responses too big to write out inside the handler. the handler sends
+// the headers, fills in a download and hands it over, then loop() feeds
+// each one only as much as its tcp send buffer has room for, so a slow
+// browser on Chart.js doesnt hold up /status for everyone else. with
+// every slot taken the body is written out in the handler like before
+
+#ifndef DOWNLOADS_MAX
+#define DOWNLOADS_MAX   5           // at once, one per tcp pcb lwip has. 0 = always in the handler
+#endif
+#define DOWNLOAD_CHUNK  1460        // most bytes handed to one client per loop(), one segment
+#define DOWNLOAD_MIN    128         // send buffer room worth a write
+#define DOWNLOAD_STALL  10000       // ms without room in the send buffer before a client is dropped
+
+struct download;
+
+// puts at most len bytes of body in buf and returns how many, 0 once
+// there is nothing left. len is never under DOWNLOAD_MIN - 8
+typedef size_t (*download_fill)(download *d, uint8_t *buf, size_t len);
+
+struct download {
+  WiFiClient client;
+  download_fill fill;
+  File file;
+  uint32_t pos;         // for fill() to keep its place with, the
+  uint32_t end;         // download code never looks at these
+  uint32_t step;
+  uint8_t part;
+  bool chunked;         // what fill() gives goes out as transfer-encoding chunks
+  uint32_t progress;    // millis() of the last write
+};
+
+void download_start(const download &d);
+void downloads_tick(void);
+int downloads_active(void);
+// how many of those are fed by fill
+int downloads_using(download_fill fill);
+
+// fill() for a plain file, the rest of d->file
+size_t download_file(download *d, uint8_t *buf, size_t len);
+
+#endif
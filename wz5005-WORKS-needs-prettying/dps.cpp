@@ -1,143 +1,817 @@
 #include "dps.hpp"
+#include "prof.hpp"
+#include "trace.hpp"
+#include "uart_rx.hpp"
 #include "settings.h"
 #include <stdint.h>
 #include "Arduino.h"
 
 
-//uint8_t voltsnamp[4] = {0x00,0x00,0x00,0x00};
-static uint8_t recvd[20] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
-static uint8_t recvd2[20] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
-static uint8_t recstart[20] = {0xAA,0x01,0x2B,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD6};
-static uint8_t readon[20] = {0xAA,0x01,0x23,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD1};
-//static uint8_t onread[20] = {0xAA,0x01,0x29,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD4};
-//static uint8_t pwrset[20] = {0xAA,0x01,0x22,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCD};
-static uint8_t poop[20] = {0xAA,0x01,0x2C,0x13,0x88,0x12,0xAB,0x01,0xF4,0x00,0x04,0x00,0x00,0x00,0x42,0x00,0x00,0x00,0x00,0x6A};
-static uint8_t offoff2[20] = {0xAA,0x01,0x22,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCD};
-static uint8_t onon2[20] = {0xAA,0x01,0x22,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCE};
-static uint8_t temp[20] = {0xAA,0x01,0x2A,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD6};
-//static uint8_t temp2[20] = {0xAA,0x01,0x2A,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD5};
-static uint8_t tempstrg[20] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
-static uint8_t onoffcccvget[20] = {0xAA,0x01,0x23,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCF};
-static uint8_t onoffcccvsave[20] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
-int addedup = (0xAA+0x01+0x2C+0x13+0x88+0x12+0xAB+0x04+0x42);
-
-uint8_t sumsum(void) {
-  uint8_t result = 0;
-  for (int i = 0; i <= 18; i++) {
-  result = (result + poop[i]);
-    }
-  return result;
-}
-
-extern volatile int doupdateon;
-extern volatile int doupdateout;
-int old = 0;
-
-bool dps_read_status(dps_status *dest) {
-
-if (doupdateout == 2) {
-if (doupdateon == 1) {
-  dest->onoff = 1;
-  dest->offon = 0;
-  Serial1.write(onon2, 20);
-  Serial.println("PSU output on");
-  delay(500);
-} else if (doupdateon == 0) {
-  dest->offon = 1;
-  dest->onoff = 0;
-  Serial1.write(offoff2, 20);
-  Serial.println("PSU output off");
-  delay(100);
-//  val = 1;
-  }
-  doupdateout = 0;
-  }
-  old = doupdateon;
-  Serial.println("dps_read_status");
-  delay(30);
-READBK:
-  Serial1.write(onoffcccvget, 20);
-  delay(100);
-   onoffcccvsave[0] = Serial.read();
-   if (onoffcccvsave[0] == 0xAA) {
-  if (Serial.available()) {
-    for (int i = 1; i <= 19; i++) {
-    onoffcccvsave[i] = Serial.read();
-    }
-   }
-  } else {
-  while (Serial.available()) {
-      Serial.read(); // read to devnull
-    }
-  goto READBK;  
-  }
-/*
-  Serial1.write(temp, 20);
-
-  delay(100);
-  Serial.println("temp =");
-  delay(50);
-  if (Serial.available()) {
-    for (int i = 0; i <= 19; i++) {
-    tempstrg[i] = Serial.read();
-    Serial.print(tempstrg[i]);
-    Serial.print(" ");
-    }
-  }
-  Serial.println("");
-  delay(50);
-*/
-  
-  Serial1.write(temp, 20);
-
-  delay(100);
-  Serial.println("temp =");
-  delay(50);
-  if (Serial.available()) {
-    for (int i = 0; i <= 19; i++) {
-    tempstrg[i] = Serial.read();
-    Serial.print(tempstrg[i], HEX);
-    Serial.print(" ");
-    }
-  }
-  Serial.println("");
-
-
-    dest->uset = (uint16_t)((poop[7] << 8) + (poop[8] & 0x00ff)); 
-    dest->iset = (uint16_t)((poop[9] << 8) + (poop[10] & 0x00ff));
-    dest->uout = (uint16_t)((poop[7] << 8) + (poop[8] & 0x00ff));;
-    dest->iout = (uint16_t)((poop[9] << 8) + (poop[10] & 0x00ff));;
-    dest->temp = 0x00; //htons2(dest->power);
-    dest->uin = 0x00; //htons2(dest->uin);
-    dest->lock = 0x00; //htons2(dest->lock);
-    dest->protect = 0x00; //htons2(dest->protect);
-    dest->cvcc = onoffcccvsave[3];
-//    dest->onoff = (uint16_t)doupdateon;
+using namespace wz5005;
+
+static const uint8_t queries[] = { GET_STATUS, GET_OUTPUT, GET_SETPOINTS };
+
+uint8_t dps_checksum(const uint8_t *frame) {
+  return checksum(frame);
+}
+
+void dps_rx_reset(dps_rx *rx) {
+  rx->pos = 0;
+}
+
+bool dps_rx_feed(dps_rx *rx, uint8_t c) {
+  if (rx->pos == 0 && c != HEADER) {
+    rx->skipped++; // still hunting for the header
+    return false;
+  }
+  rx->frame[rx->pos++] = c;
+  if (rx->pos < FRAME_LEN) {
+    return false;
+  }
+  if (valid(rx->frame)) {
+    rx->pos = 0;
+    rx->frames++;
     return true;
+  }
+
+  // the 0xAA we started on was data (a byte got lost, or we came in mid
+  // frame). the real header may be further in, keep from there on
+  rx->badsum++;
+  uint8_t i = 1;
+  while (i < FRAME_LEN && rx->frame[i] != HEADER) {
+    i++;
+  }
+  rx->skipped += i;
+  if (i < FRAME_LEN) {
+    rx->resyncs++;
+    memmove(rx->frame.data(), rx->frame.data() + i, FRAME_LEN - i);
+  }
+  rx->pos = FRAME_LEN - i;
+  return false;
+}
+
+// one of these per address we look for on the bus. the slot keeps its
+// place in the table when the supply behind it is given a new address
+struct dps_dev {
+  uint8_t addr;
+  bool present;
+  unsigned long lastseen;
+  dps_status snap[2];               // double buffered, readers only ever see snap[front]
+  volatile uint8_t front;
+  uint8_t nextquery;
+  SetSetpoints setp;                // what we last told (or heard from) the supply
+  uint16_t want_v;
+  uint16_t want_i;
+};
+
+static dps_rx rx;
+static dps_dev devs[DPS_DEVICES];
+static uint8_t nextdev = 0;
+static uint8_t nextscan = 0;
+static unsigned long lastquery = 0;
+static unsigned long lastscan = 0;
+
+// how long each kind of command really takes to get answered, measured
+// from the moment it is handed to the uart, or the reply ahead of it in
+// the same burst came in, to the arrival stamp of the last reply byte.
+// One histogram per command byte in DPS_LAT_BUCKET ms steps, counts are
+// halved whenever one fills up so old samples fade out and p50/p99
+// follow the supply rather than its history. A reply that never comes
+// counts as taking the whole timeout, so a timeout that is too short
+// keeps growing until replies fit in it again
+static const uint8_t latcmds[] = {
+  SET_MODE, SET_ADDRESS, SET_OUTPUT, GET_STATUS, GET_INFO,
+  GET_OUTPUT, GET_STATS, GET_SETPOINTS, SET_SETPOINTS,
+};
+
+struct dps_latstat {
+  uint8_t hist[DPS_LAT_BUCKETS];
+  uint16_t total;                     // sum of hist[]
+  uint32_t replies;
+  uint32_t timeouts;
+  uint16_t p50;
+  uint16_t p99;
+  uint16_t timeout;                   // ms
+};
+
+static dps_latstat lats[sizeof(latcmds)];
+
+static dps_latstat *dps_lat_find(uint8_t cmd) {
+  for (size_t i = 0; i < sizeof(latcmds); i++) {
+    if (latcmds[i] == cmd) {
+      return &lats[i];
+    }
+  }
+  return NULL;
+}
+
+static uint16_t dps_lat_percentile(const dps_latstat *l, uint16_t permille) {
+  uint32_t want = ((uint32_t)l->total * permille + 999) / 1000;
+  uint32_t seen = 0;
+  for (int i = 0; i < DPS_LAT_BUCKETS; i++) {
+    seen += l->hist[i];
+    if (seen >= want) {
+      return (i + 1) * DPS_LAT_BUCKET;
+    }
+  }
+  return DPS_LAT_BUCKETS * DPS_LAT_BUCKET;
+}
+
+static uint16_t dps_timeout(uint8_t cmd) {
+  dps_latstat *l = dps_lat_find(cmd);
+  return l && l->timeout ? l->timeout : DPS_REPLY_TIMEOUT;
+}
+
+static void dps_lat_sample(uint8_t cmd, uint32_t us, bool timedout) {
+  dps_latstat *l = dps_lat_find(cmd);
+  if (!l) {
+    return;
+  }
+  uint32_t b = us / (DPS_LAT_BUCKET * 1000UL);
+  if (b >= DPS_LAT_BUCKETS) {
+    b = DPS_LAT_BUCKETS - 1;
+  }
+  if (l->hist[b] == 0xFF) {
+    l->total = 0;
+    for (int i = 0; i < DPS_LAT_BUCKETS; i++) {
+      l->hist[i] >>= 1;
+      l->total += l->hist[i];
+    }
+  }
+  l->hist[b]++;
+  l->total++;
+  if (timedout) {
+    l->timeouts++;
+  } else {
+    l->replies++;
+  }
+  l->p50 = dps_lat_percentile(l, 500);
+  l->p99 = dps_lat_percentile(l, 990);
+  if (l->replies >= DPS_LAT_WARMUP) {
+    // half as much again as the slow end of what we have seen
+    uint16_t t = l->p99 + l->p99 / 2;
+    if (t < DPS_REPLY_TIMEOUT_MIN) {
+      t = DPS_REPLY_TIMEOUT_MIN;
+    } else if (t > DPS_REPLY_TIMEOUT_MAX) {
+      t = DPS_REPLY_TIMEOUT_MAX;
+    }
+    l->timeout = t;
+  }
+}
+
+// transactions on the wire. reads for one supply go out back to back, up
+// to DPS_PIPELINE of them, and each reply is matched to its request by
+// address and command byte so they may come back in any order or not at
+// all. sets always go out on their own, every one of them is answered by
+// the same 0x12 ack so there would be no telling them apart. a slot frees
+// itself when its reply is in, or once the timeout for its command is up
+struct dps_txn {
+  bool busy;
+  uint8_t addr;
+  uint8_t cmd;
+  uint8_t seq;                        // order it went out in
+  uint32_t sentat;                    // micros()
+  uint32_t timeout;                   // us
+};
+
+static dps_txn inflight[DPS_PIPELINE];
+static uint8_t ninflight = 0;
+static uint8_t nextseq = 0;
+static uint32_t busfree = 0;          // micros() the last reply came in or the last wait was given up on
+static dps_stats stats;
+
+// the bridge's frame. it always goes out on its own, so whatever answers
+// while it is on the wire is its reply
+static Buffer rawreq, rawrep;
+static bool rawqueued = false;
+static bool rawwait = false;
+static bool rawready = false;
+static bool rawlast = false;        // the last slot went to the bridge
+static bool rawdrop = false;        // the one on the wire was cancelled, its reply goes nowhere
+
+static void dps_set_failed(void);
+static dps_dev *dps_find(uint8_t addr);
+static void dps_timed_out(dps_txn *t, uint32_t now);
+
+static bool dps_is_set(uint8_t cmd) {
+  return cmd == SET_MODE || cmd == SET_ADDRESS || cmd == SET_OUTPUT || cmd == SET_SETPOINTS;
+}
+
+// callers check ninflight < DPS_PIPELINE first. a whole burst is at most
+// 20 * DPS_PIPELINE bytes which sits in the 128 byte tx fifo, so this
+// never blocks
+static void dps_send(const Buffer &buf) {
+  for (int i = 0; i < DPS_PIPELINE; i++) {
+    dps_txn *t = &inflight[i];
+    if (!t->busy) {
+      t->busy = true;
+      t->addr = buf[1];
+      t->cmd = buf[2];
+      t->seq = nextseq++;
+      t->sentat = micros();
+      t->timeout = dps_timeout(t->cmd) * 1000UL;
+      ninflight++;
+      break;
+    }
+  }
+  Serial1.write(buf.data(), buf.size());
+}
+
+// how long t has been the one the supply is working on. a query sent
+// behind others in the same burst only has the supply to itself once
+// the reply ahead of it is in, counting from sentat would time the queue
+// as well
+static uint32_t dps_waited(const dps_txn *t, uint32_t now) {
+  uint32_t from = (int32_t)(busfree - t->sentat) > 0 ? busfree : t->sentat;
+  return now - from;
+}
+
+// its timeout doesnt start while one sent before it is still out
+static bool dps_ahead(const dps_txn *t) {
+  for (int i = 0; i < DPS_PIPELINE; i++) {
+    if (inflight[i].busy && (int8_t)(inflight[i].seq - t->seq) < 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// which command the reply answers, 0 when nothing was waiting for it. an
+// ack that matches no set is the supply refusing one of our queries
+// (garbled on the way out), and it answers in order, so it goes to the
+// oldest one outstanding for that address
+static uint8_t dps_complete(uint8_t addr, uint8_t cmd, uint32_t stamp) {
+  dps_txn *match = NULL;
+  for (int i = 0; i < DPS_PIPELINE; i++) {
+    dps_txn *t = &inflight[i];
+    if (!t->busy || t->addr != addr) {
+      continue;
+    }
+    if (t->cmd == cmd || (cmd == ACK && dps_is_set(t->cmd))) {
+      match = t;
+      break;
+    }
+    if (cmd == ACK && (!match || t->sentat - match->sentat > 0x80000000UL)) {
+      match = t;
+    }
+  }
+  if (!match) {
+    return 0;
+  }
+  uint8_t was = match->cmd;
+  uint32_t took = dps_waited(match, stamp);
+  if (!dps_ahead(match) && took >= match->timeout) {
+    // dps_poll() runs before dps_expire(), so after loop() stalled a
+    // reply that came in well past its deadline is still in the ring.
+    // it is a timeout, its time mustnt go into the learned one
+    dps_timed_out(match, stamp);
+    return 0;
+  }
+  dps_lat_sample(was, took, false);
+  // from the rx isr's stamp rather than the cycle counter now, which
+  // would add however long the reply sat in the ring. 53 s of them is
+  // already past 32 bits at 80MHz
+  PROF_ADD(was == GET_STATUS ? PROF_UART_STATUS : was == GET_OUTPUT ? PROF_UART_OUTPUT :
+           was == GET_SETPOINTS ? PROF_UART_SETPOINTS : PROF_UART_SET,
+           (uint64_t)took * ESP.getCpuFreqMHz() > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : took * ESP.getCpuFreqMHz());
+  busfree = stamp;
+  match->busy = false;
+  ninflight--;
+  return was;
+}
+
+// not coming, or came after its time was up. only counts against the
+// timeout when the supply is there, the rescan probes of empty addresses
+// never get an answer
+static void dps_timed_out(dps_txn *t, uint32_t now) {
+  dps_dev *d = dps_find(t->addr);
+  if (d && d->present) {
+    dps_lat_sample(t->cmd, t->timeout, true);
+  }
+  stats.timeouts++;
+  TRACE_ERROR(TR_TIMEOUT, t->addr, t->cmd, t->timeout / 1000);
+  if (rawwait) {
+    rawwait = false;                // not ours to retry, the far end times out itself
+    rawdrop = false;
+  } else if (dps_is_set(t->cmd)) {
+    dps_set_failed();
+  }
+  t->busy = false;
+  ninflight--;
+  busfree = now;
+}
+
+static void dps_expire(void) {
+  for (int i = 0; i < DPS_PIPELINE; i++) {
+    dps_txn *t = &inflight[i];
+    if (t->busy && !dps_ahead(t) && dps_waited(t, micros()) >= t->timeout) {
+      dps_timed_out(t, micros());
+    }
+  }
+}
+
+static void dps_count_ack(uint8_t code) {
+  switch (code) {
+  case ELSEHRM:         stats.acks++; break;
+  case BADTXCHKSM:      stats.badtxchksm++; break;
+  case BADCMNDOROVRFLW: stats.badcmndorovrflw++; break;
+  case BADCMNDCNTEXEC:  stats.badcmndcntexec++; break;
+  case INVALIDCMD:      stats.invalidcmd++; break;
+  case UNKNOWNCMD:      stats.unknowncmd++; break;
+  default:              stats.othererr++; break;
+  }
+}
+
+// outbound commands wait here for a free slot on the bus. a 0x2C behind
+// another 0x2C for the same supply just overwrites it, so dragging the
+// voltage box sends one frame per slot with the newest values instead of
+// one per keystroke
+struct dps_cmd {
+  uint8_t dev;
+  uint8_t cmd;
+  uint16_t a;
+  uint16_t b;
+};
+
+static dps_cmd cmdq[DPS_CMDQ_LEN];
+static uint8_t cmdq_head = 0;
+static uint8_t cmdq_count = 0;
+
+// the last set sent, so it can go again if the supply says no or doesnt
+// answer. the bus is left quiet for the backoff first, on a noisy line
+// hammering it straight away mostly gets the same result
+static dps_cmd lastset;
+static uint8_t settries = 0;
+static bool retrying = false;
+static unsigned long retryat = 0;
+
+static void dps_set_failed(void) {
+  // a renumber has already been applied to our table when it went out,
+  // sending it again would come from the wrong address
+  if (lastset.cmd == SET_ADDRESS || settries >= DPS_SET_RETRIES) {
+    stats.giveups++;
+    TRACE_ERROR(TR_GIVEUP, lastset.cmd, settries);
+    retrying = false;
+    return;
+  }
+  retryat = millis() + ((unsigned long)DPS_RETRY_BACKOFF << settries);
+  settries++;
+  retrying = true;
+}
+
+static void dps_init(void) {
+  static bool done = false;
+  if (done) {
+    return;
+  }
+  done = true;
+  for (int i = 0; i < DPS_DEVICES; i++) {
+    dps_dev *d = &devs[i];
+    d->addr = DEFAULT_ADDR + i;
+    // 5V out of the box
+    d->setp = { 0x1388, 0x12AB, 500, 4, {0x00,0x00,0x00,0x42,0x00,0x00,0x00,0x00} };
+    d->want_v = d->setp.uset;
+    d->want_i = d->setp.iset;
+  }
+}
+
+static dps_dev *dps_find(uint8_t addr) {
+  dps_init();
+  for (int i = 0; i < DPS_DEVICES; i++) {
+    if (devs[i].addr == addr) {
+      return &devs[i];
+    }
+  }
+  return NULL;
+}
+
+static bool dps_queued(const dps_dev *d) {
+  for (int i = 0; i < cmdq_count; i++) {
+    if (cmdq[(cmdq_head + i) % DPS_CMDQ_LEN].dev == d - devs) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void dps_dispatch(const Buffer &buf) {
+  Frame f;
+  if (Frame::decode(buf, f) != Error::OK) {
+    return;
+  }
+  uint8_t was = dps_complete(f.addr, f.cmd, rx.stamp);
+  bool raw = rawwait && was;
+  if (raw) {
+    rawwait = false;
+    if (rawdrop) {
+      rawdrop = false;              // its client has gone since
+    } else {
+      rawrep = buf;
+      rawready = true;
+    }
+  }
+  if (f.cmd == ACK) {
+    dps_count_ack(f.args[0]);
+    if (f.args[0] != ELSEHRM) {
+      TRACE_ERROR(TR_NACK, f.addr, f.args[0], was);
+    }
+    if (dps_is_set(was) && f.args[0] != ELSEHRM && !raw) {
+      dps_set_failed();
+    }
+  }
+
+  // the bridge may talk to an address outside the table, its reply is
+  // taken above and there is no snapshot to put it in
+  dps_dev *d = dps_find(f.addr);
+  if (!d) {
+    return;
+  }
+  if (!d->present) {
+    TRACE_INFO(TR_FOUND, f.addr);
+  }
+  d->present = true;
+  d->lastseen = millis();
+
+  dps_status *back = &d->snap[d->front ^ 1];
+  *back = d->snap[d->front];
+  switch (f.cmd) {
+  case ACK:
+    // nothing reads the mode back off the supply, so lock is the last
+    // 0x20 it took, ours or one the bridge sent
+    if (was == SET_MODE && f.args[0] == ELSEHRM) {
+      back->lock = raw ? rawreq[3] != 0 : lastset.a != 0;
+      d->front ^= 1;
+    }
+    return;
+  case GET_STATUS: {
+    Status st;
+    st.from(f);
+    back->onoff = st.on;
+    back->offon = !st.on;
+    back->cvcc = st.cc;
+    back->protect = st.abnormal;
+    break;
+  }
+  case GET_OUTPUT: {
+    Output out;
+    out.from(f);
+    back->uout = out.uout;
+    back->iout = out.iout;
+    break;
+  }
+  case GET_STATS:
+    TRACE_DEBUG(TR_STATS, f.addr, f.u16(0), f.u16(2), f.u16(4));
+    return;
+  case GET_SETPOINTS: {
+    Setpoints sp;
+    sp.from(f);
+    back->uset = sp.uset;
+    back->iset = sp.iset;
+    // keep our set frame in step with what the supply really has, so the
+    // next set voltage/current doesnt clobber ovp/ocp with stale values.
+    // not while a set is still queued tho, that would undo it, and only
+    // off a reply to our own 0x2B, not one the bridge asked for or that
+    // came in after its slot timed out
+    if (was == GET_SETPOINTS && !raw && !dps_queued(d)) {
+      d->setp.ovp = sp.ovp;
+      d->setp.ocp = sp.ocp;
+      d->setp.uset = sp.uset;
+      d->setp.iset = sp.iset;
+      memcpy(d->setp.tail, sp.tail, sizeof(d->setp.tail));
+      d->want_v = sp.uset;
+      d->want_i = sp.iset;
+    }
+    break;
+  }
+  default:
+    return;
+  }
+  back->stamp = millis();
+  d->front ^= 1;
 }
 
-bool dps_set_voltage(const uint16_t voltage) {
-  dps_status dps;
-  delay(100);
-  poop[7] = ((uint8_t)(voltage >> 8));
-  poop[8] = ((uint8_t)voltage);
-  poop[19] = sumsum();
-  Serial1.write(poop, 20);
-  delay(200);
+// called from loop(), eats whatever the uart has without ever waiting
+void dps_poll(void) {
+  uint8_t c;
+  uint32_t stamp;
+  while (uart_rx_read(&c, &stamp)) {
+    rx.stamp = stamp;
+    uint32_t badsum = rx.badsum;
+    if (dps_rx_feed(&rx, c)) {
+      dps_dispatch(rx.frame);
+    } else if (rx.badsum != badsum) {
+      // traced here rather than in dps_rx_feed(), the bridge decodes its
+      // client's bytes with it too and those arent the link's garbage.
+      // what is kept of the window after a header found in it is in pos
+      TRACE_ERROR(TR_BADFRAME, FRAME_LEN - rx.pos, rx.pos != 0);
+    }
+  }
+}
+
+static bool dps_enqueue(dps_dev *d, uint8_t cmd, uint16_t a, uint16_t b) {
+  if (!d) {
+    return false;
+  }
+  uint8_t dev = d - devs;
+  if (cmdq_count && cmd == SET_SETPOINTS) {
+    dps_cmd *tail = &cmdq[(cmdq_head + cmdq_count - 1) % DPS_CMDQ_LEN];
+    if (tail->cmd == SET_SETPOINTS && tail->dev == dev) {
+      tail->a = a;
+      tail->b = b;
+      return true;
+    }
+  }
+  if (cmdq_count == DPS_CMDQ_LEN) {
+    return false;
+  }
+  dps_cmd *slot = &cmdq[(cmdq_head + cmdq_count) % DPS_CMDQ_LEN];
+  slot->dev = dev;
+  slot->cmd = cmd;
+  slot->a = a;
+  slot->b = b;
+  cmdq_count++;
   return true;
 }
 
-bool dps_set_current(const uint16_t current) {
-  poop[9] = ((uint8_t)(current >> 8));
-  poop[10] = ((uint8_t)current);
-  poop[19] = sumsum();
-  Serial1.write(poop, 20);
-  delay(200);
-return true;
+static void dps_send_cmd(const dps_cmd *c) {
+  dps_dev *d = &devs[c->dev];
+  Buffer buf;
+
+  lastset = *c;
+  TRACE_INFO(TR_SEND, d->addr, c->cmd, c->a, c->b);
+
+  if (c->cmd == SET_SETPOINTS) {
+    d->setp.uset = c->a;
+    d->setp.iset = c->b;
+    encode(d->setp, buf, d->addr);
+    dps_send(buf);
+    return;
+  }
+
+  if (c->cmd == SET_MODE) {
+    encode(SetMode{ c->a != 0 }, buf, d->addr);
+    dps_send(buf);
+    return;
+  }
+
+  if (c->cmd == SET_ADDRESS) {
+    encode(SetAddress{ (uint8_t)c->a }, buf, d->addr);
+    dps_send(buf);
+    // an empty slot sitting on the new address gets the old one instead
+    dps_dev *other = dps_find((uint8_t)c->a);
+    if (other) {
+      other->addr = d->addr;
+    }
+    d->addr = (uint8_t)c->a;
+    return;
+  }
+
+  dps_status *back = &d->snap[d->front ^ 1];
+  *back = d->snap[d->front];
+  if (c->a) {
+    back->onoff = 1;
+    back->offon = 0;
+  } else {
+    back->offon = 1;
+    back->onoff = 0;
+  }
+  encode(SetOutput{ c->a != 0 }, buf, d->addr);
+  dps_send(buf);
+  d->front ^= 1;
+}
+
+// every so often spend a slot asking one of the addresses that isnt
+// answering, so a supply plugged in later still shows up
+static dps_dev *dps_next_scan(void) {
+  if (millis() - lastscan < DPS_RESCAN_INTERVAL) {
+    return NULL;
+  }
+  for (int i = 0; i < DPS_DEVICES; i++) {
+    dps_dev *d = &devs[(nextscan + i) % DPS_DEVICES];
+    if (!d->present) {
+      nextscan = (d - devs + 1) % DPS_DEVICES;
+      lastscan = millis();
+      return d;
+    }
+  }
+  lastscan = millis();
+  return NULL;
+}
+
+static dps_dev *dps_next_present(void) {
+  for (int i = 0; i < DPS_DEVICES; i++) {
+    dps_dev *d = &devs[(nextdev + i) % DPS_DEVICES];
+    if (d->present) {
+      nextdev = (d - devs + 1) % DPS_DEVICES;
+      return d;
+    }
+  }
+  return NULL;
+}
+
+// background poller, also from loop(). Queued commands go out on their
+// own as soon as nothing else is on the wire, otherwise every
+// DPS_POLL_INTERVAL ms one supply gets a round of queries sent back to
+// back, taking turns between the supplies that answer, so the bus load is
+// the same no matter how many browsers are watching. A new round only
+// starts once the last one is answered or timed out
+void dps_tick(void) {
+  dps_init();
+  dps_poll();
+  dps_expire();
+
+  for (int i = 0; i < DPS_DEVICES; i++) {
+    if (devs[i].present && millis() - devs[i].lastseen > DPS_DEV_TIMEOUT) {
+      devs[i].present = false;
+      TRACE_INFO(TR_LOST, devs[i].addr);
+    }
+  }
+
+  if (ninflight) {
+    return;
+  }
+
+  if (retrying) {
+    if ((long)(millis() - retryat) < 0) {
+      return; // backing off, bus stays quiet
+    }
+    retrying = false;
+    stats.retries++;
+    TRACE_INFO(TR_RETRY, lastset.cmd, settries);
+    dps_send_cmd(&lastset);
+    return;
+  }
+
+  if (cmdq_count) {
+    settries = 0;
+    dps_send_cmd(&cmdq[cmdq_head]);
+    cmdq_head = (cmdq_head + 1) % DPS_CMDQ_LEN;
+    cmdq_count--;
+    return;
+  }
+
+  // the bridge takes turns with the rounds when both want the bus, a host
+  // tool sending flat out still leaves the snapshot fresh
+  bool due = millis() - lastquery >= DPS_POLL_INTERVAL;
+  if (rawqueued && !(rawlast && due)) {
+    rawqueued = false;
+    rawwait = true;
+    rawlast = true;
+    TRACE_DEBUG(TR_BRIDGE, rawreq[1], rawreq[2]);
+    dps_send(rawreq);
+    return;
+  }
+
+  if (!due) {
+    return;
+  }
+  lastquery = millis();
+  rawlast = false;
+
+  dps_dev *d = dps_next_scan();
+  if (d) {
+    dps_send(frame(GET_STATUS, 0x01, d->addr));
+  } else if ((d = dps_next_present())) {
+    for (size_t n = 0; n < sizeof(queries) && ninflight < DPS_PIPELINE; n++) {
+      uint8_t q = queries[d->nextquery];
+      dps_send(frame(q, q == GET_STATUS ? 0x01 : 0x00, d->addr));
+      d->nextquery = (d->nextquery + 1) % sizeof(queries);
+    }
+  } else {
+    // nothing answering at all, walk the whole table every slot
+    d = &devs[nextscan];
+    nextscan = (nextscan + 1) % DPS_DEVICES;
+    dps_send(frame(GET_STATUS, 0x01, d->addr));
+  }
+}
+
+const dps_status *dps_snapshot(const uint8_t addr) {
+  dps_dev *d = dps_find(addr);
+  return d ? &d->snap[d->front] : NULL;
+}
+
+// no uart traffic here at all, just the newest snapshot. false until the
+// supply has answered at least once
+bool dps_read_status(dps_status *dest, const uint8_t addr) {
+  const dps_status *s = dps_snapshot(addr);
+  if (!s) {
+    return false;
+  }
+  *dest = *s;
+  return dest->stamp != 0;
+}
+
+int dps_devices(uint8_t *addrs, const int max) {
+  int n = 0;
+  dps_init();
+  for (int i = 0; i < DPS_DEVICES && n < max; i++) {
+    if (devs[i].present) {
+      addrs[n++] = devs[i].addr;
+    }
+  }
+  return n;
+}
+
+// these only queue the frame, dps_tick() puts it on the wire. false
+// means the queue is full or nothing lives at that address
+bool dps_set_voltage(const uint16_t voltage, const uint8_t addr) {
+  dps_dev *d = dps_find(addr);
+  if (!d) {
+    return false;
+  }
+  d->want_v = voltage;
+  return dps_enqueue(d, SET_SETPOINTS, d->want_v, d->want_i);
+}
+
+bool dps_set_current(const uint16_t current, const uint8_t addr) {
+  dps_dev *d = dps_find(addr);
+  if (!d) {
+    return false;
+  }
+  d->want_i = current;
+  return dps_enqueue(d, SET_SETPOINTS, d->want_v, d->want_i);
+}
+
+bool dps_set_voltage_current(const uint16_t voltage, const uint16_t current, const uint8_t addr) {
+  dps_dev *d = dps_find(addr);
+  if (!d) {
+    return false;
+  }
+  d->want_v = voltage;
+  d->want_i = current;
+  return dps_enqueue(d, SET_SETPOINTS, d->want_v, d->want_i);
+}
+
+bool dps_set_output(const bool on, const uint8_t addr) {
+  return dps_enqueue(dps_find(addr), SET_OUTPUT, on ? 1 : 0, 0);
+}
+
+// 0x20, front panel (false) or remote control (true)
+bool dps_set_mode(const bool remote, const uint8_t addr) {
+  return dps_enqueue(dps_find(addr), SET_MODE, remote ? 1 : 0, 0);
+}
+
+// 0x21, renumber a supply. only one supply may sit at the old address
+// when this goes out or they all take the new one
+bool dps_set_address(const uint8_t addr, const uint8_t newaddr) {
+  dps_dev *other = dps_find(newaddr);
+  if (other && other->present) {
+    return false;
+  }
+  return dps_enqueue(dps_find(addr), SET_ADDRESS, newaddr, 0);
+}
+
+bool dps_is_request(uint8_t cmd) {
+  return dps_lat_find(cmd) != NULL;
+}
+
+bool dps_raw_send(const uint8_t *frame) {
+  if (rawqueued || rawwait || !dps_is_request(frame[2])) {
+    return false;
+  }
+  memcpy(rawreq.data(), frame, FRAME_LEN);
+  rawqueued = true;
+  return true;
+}
+
+void dps_raw_cancel(void) {
+  rawqueued = false;
+  rawready = false;
+  rawdrop = rawwait;
+}
+
+bool dps_raw_reply(uint8_t *frame) {
+  if (!rawready) {
+    return false;
+  }
+  memcpy(frame, rawrep.data(), FRAME_LEN);
+  rawready = false;
+  return true;
+}
+
+int dps_latency(dps_lat *out, const int max) {
+  int n = 0;
+  for (size_t i = 0; i < sizeof(latcmds) && n < max; i++) {
+    const dps_latstat *l = &lats[i];
+    if (!l->replies && !l->timeouts) {
+      continue;
+    }
+    out[n].cmd = latcmds[i];
+    out[n].replies = l->replies;
+    out[n].timeouts = l->timeouts;
+    out[n].p50 = l->p50;
+    out[n].p99 = l->p99;
+    out[n].timeout = dps_timeout(latcmds[i]);
+    n++;
+  }
+  return n;
 }
 
-bool dps_set_voltage_current(const uint16_t voltage, const uint16_t current) {
-  dps_set_current(current);
-  dps_set_voltage(voltage);
-return 0;
+void dps_stats_get(dps_stats *out) {
+  *out = stats;
+  out->frames = rx.frames;
+  out->badsum = rx.badsum;
+  out->resyncs = rx.resyncs;
+  out->skipped = rx.skipped;
+  out->overflows = uart_rx_overflows();
 }
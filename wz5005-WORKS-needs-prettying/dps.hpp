@@ -3,6 +3,7 @@
 #define __DPS__
 
 #include <stdint.h>
+#include "wz5005.hpp"
 
 #define MIN_VOLTAGE 0
 #define MAX_VOLTAGE 5000
@@ -16,10 +17,25 @@
 #define UNKNOWNCMD    0xD0          // 208 unknown command
 #define ELSEHRM       0x80          // 128 if it aint one of the ones listed above then it gets this
 
-#define htons2(x) ( ((x)<< 8 & 0xFF00) | ((x)>> 8 & 0x00FF) )
+#define DPS_CMDQ_LEN      8         // outbound commands waiting for a bus slot
+#define DPS_DEV_TIMEOUT   3000      // ms of silence before a supply counts as gone
+#define DPS_RESCAN_INTERVAL 5000    // ms between probes of addresses that dont answer
+#define DPS_REPLY_TIMEOUT 100       // ms to wait for an answer until enough have been timed
+#define DPS_REPLY_TIMEOUT_MIN 20    // learned timeouts stay within these
+#define DPS_REPLY_TIMEOUT_MAX 250
+#define DPS_LAT_BUCKET    2         // ms per latency histogram bucket
+#define DPS_LAT_BUCKETS   128       // the last one catches everything slower
+#define DPS_LAT_WARMUP    16        // replies timed before the learned timeout is used
+#define DPS_SET_RETRIES   3         // extra tries for a set that is refused or not acked
+#define DPS_RETRY_BACKOFF 50        // ms of quiet bus before the first retry, doubles each time
+// queries on the wire at once, a status round goes out back to back and
+// the replies are matched by command. 1 = strictly one at a time, for a
+// supply that `wz5005-pollrate -p 3` shows losing replies
+#ifndef DPS_PIPELINE
+#define DPS_PIPELINE      3
+#endif
 
-extern volatile int doupdateon;
-extern volatile int doupdateout;
+#define htons2(x) ( ((x)<< 8 & 0xFF00) | ((x)>> 8 & 0x00FF) )
 
 struct dps_status {
   uint16_t uset;
@@ -28,16 +44,87 @@ struct dps_status {
   uint16_t iout;
   uint16_t temp;
   uint16_t uin;
-  uint16_t lock;
+  uint16_t lock;        // remote mode, as last acked to a 0x20
   uint16_t protect;
   uint16_t cvcc;
   uint16_t onoff;
   uint16_t offon;
+  uint32_t stamp;       // millis() of the newest reply folded in, 0 = none yet
 };
 
-bool dps_read_status(dps_status *dest);
-bool dps_set_voltage(const uint16_t voltage);
-bool dps_set_current(const uint16_t current);
-bool dps_set_voltage_current(const uint16_t voltage, const uint16_t current);
+// byte driven receive state machine, feed it one byte at a time and it
+// says when frame[] holds a complete frame with a good checksum. 20 bytes
+// that dont add up arent thrown away whole, the window slides to the next
+// 0xAA in them so a frame that started part way in is still picked up
+struct dps_rx {
+  wz5005::Buffer frame;
+  uint8_t pos;
+  uint32_t stamp;       // micros() the newest byte arrived, see uart_rx
+  uint32_t frames;      // good ones handed out
+  uint32_t badsum;      // 20 bytes from a header that failed the checksum
+  uint32_t resyncs;     // of those, times a later header in the window was taken up
+  uint32_t skipped;     // bytes dropped hunting for a header
+};
+
+// link health for /diag/link, see dps_stats()
+struct dps_stats {
+  uint32_t frames;
+  uint32_t badsum;
+  uint32_t resyncs;
+  uint32_t skipped;
+  uint32_t overflows;   // uart_rx ring full, bytes lost before we saw them
+  uint32_t timeouts;    // requests that got no reply at all
+  uint32_t acks;        // 0x12 with ELSEHRM, all good
+  uint32_t badtxchksm;  // 0x12 with one of the error codes above
+  uint32_t badcmndorovrflw;
+  uint32_t badcmndcntexec;
+  uint32_t invalidcmd;
+  uint32_t unknowncmd;
+  uint32_t othererr;
+  uint32_t retries;     // sets sent again after an error or timeout
+  uint32_t giveups;     // sets dropped after DPS_SET_RETRIES
+};
+
+// request to reply timing for one command byte, from dps_latency(). ms,
+// p50/p99 are the top edge of their histogram bucket
+struct dps_lat {
+  uint8_t cmd;
+  uint32_t replies;
+  uint32_t timeouts;
+  uint16_t p50;
+  uint16_t p99;
+  uint16_t timeout;     // what the next one of these gets to answer
+};
+
+uint8_t dps_checksum(const uint8_t *frame);
+void dps_rx_reset(dps_rx *rx);
+bool dps_rx_feed(dps_rx *rx, uint8_t c);
+
+// everything below takes the bus address of the supply, 0x01 unless it
+// was changed with dps_set_address()
+void dps_poll(void);
+void dps_tick(void);
+const dps_status *dps_snapshot(const uint8_t addr = wz5005::DEFAULT_ADDR);
+bool dps_read_status(dps_status *dest, const uint8_t addr = wz5005::DEFAULT_ADDR);
+int dps_devices(uint8_t *addrs, const int max);
+bool dps_set_voltage(const uint16_t voltage, const uint8_t addr = wz5005::DEFAULT_ADDR);
+bool dps_set_current(const uint16_t current, const uint8_t addr = wz5005::DEFAULT_ADDR);
+bool dps_set_voltage_current(const uint16_t voltage, const uint16_t current, const uint8_t addr = wz5005::DEFAULT_ADDR);
+bool dps_set_output(const bool on, const uint8_t addr = wz5005::DEFAULT_ADDR);
+bool dps_set_mode(const bool remote, const uint8_t addr = wz5005::DEFAULT_ADDR);
+bool dps_set_address(const uint8_t addr, const uint8_t newaddr);
+
+// a whole frame from outside (the tcp bridge) to go out as is. it gets a
+// bus slot of its own between the poller's, false while the last one is
+// still waiting for its slot or its reply. the reply, if one comes, is
+// picked up with dps_raw_reply() and goes thru the snapshot like any other.
+// only the commands the supply takes go out, dps_is_request() says which
+bool dps_is_request(uint8_t cmd);
+bool dps_raw_send(const uint8_t *frame);
+bool dps_raw_reply(uint8_t *frame);
+// forget the bridge frame, queued or on the wire, and any reply to it
+void dps_raw_cancel(void);
+int dps_latency(dps_lat *out, const int max);
+void dps_stats_get(dps_stats *out);
 
 #endif
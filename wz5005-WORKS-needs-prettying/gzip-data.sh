@@ -0,0 +1,12 @@
+#!/bin/sh
+# gzip the static assets in data/ before "ESP8266 Sketch Data Upload".
+# handleFiles() sends name.gz with Content-Encoding: gzip when it is there
+# and the browser takes gzip, and uses the crc in its trailer as the ETag.
+# index.html is left alone, /deploy replaces it uncompressed.
+# -n keeps names and times out so the same input gives the same bytes
+cd "$(dirname "$0")/data" || exit 1
+for f in *.css *.js; do
+  [ -f "$f" ] || continue
+  gzip -9 -n -c "$f" > "$f.gz"
+  echo "$f $(wc -c < "$f") -> $(wc -c < "$f.gz")"
+done
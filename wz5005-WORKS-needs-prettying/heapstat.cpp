@@ -0,0 +1,71 @@
+#include "heapstat.hpp"
+#include "settings.h"
+#include <stdint.h>
+#include "Arduino.h"
+
+static heapstat_sample ring[HEAP_SAMPLES];
+static int head = 0;              // next slot to write
+static int count = 0;
+static heapstat now = { 0, 0, 0, 0xFFFFFFFF, 0xFFFFFFFF, 0, 0 };
+static heapstat_sample cur = { 0xFFFF, 0xFFFF, 0 };
+static unsigned long lastread = 0;
+static unsigned long lastsample = 0;
+static uint64_t upms = 0;
+static unsigned long upread = 0;
+
+static uint16_t cap16(uint32_t v) {
+  return v > 0xFFFF ? 0xFFFF : v;
+}
+
+uint32_t heapstat_uptime(void) {
+  upms += (uint32_t)(millis() - upread);
+  upread = millis();
+  return upms / 1000;
+}
+
+void heapstat_tick(void) {
+  if (millis() - lastread < 1000) {
+    return;
+  }
+  now.uptime = heapstat_uptime();
+  lastread = millis();
+
+  now.freeheap = ESP.getFreeHeap();
+  now.maxblock = ESP.getMaxFreeBlockSize();
+  now.frag = ESP.getHeapFragmentation();
+  if (now.freeheap < now.minfree) now.minfree = now.freeheap;
+  if (now.maxblock < now.minblock) now.minblock = now.maxblock;
+  if (now.frag > now.maxfrag) now.maxfrag = now.frag;
+  if (cap16(now.freeheap) < cur.freeheap) cur.freeheap = cap16(now.freeheap);
+  if (cap16(now.maxblock) < cur.maxblock) cur.maxblock = cap16(now.maxblock);
+  if (now.frag > cur.frag) cur.frag = now.frag;
+
+  if (millis() - lastsample < HEAP_INTERVAL) {
+    return;
+  }
+  lastsample = millis();
+  ring[head] = cur;
+  head = (head + 1) % HEAP_SAMPLES;
+  if (count < HEAP_SAMPLES) {
+    count++;
+  }
+  cur.freeheap = cur.maxblock = 0xFFFF;
+  cur.frag = 0;
+}
+
+void heapstat_get(heapstat *out) {
+  *out = now;
+}
+
+int heapstat_count(void) {
+  return count;
+}
+
+// 0 = oldest
+bool heapstat_sample_get(int i, heapstat_sample *dest) {
+  if (i < 0 || i >= count) {
+    return false;
+  }
+  *dest = ring[(head - count + i + HEAP_SAMPLES) % HEAP_SAMPLES];
+  return true;
+}
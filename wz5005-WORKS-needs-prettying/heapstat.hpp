@@ -0,0 +1,37 @@
+#ifndef __HEAPSTAT__
+#define __HEAPSTAT__
+
+#include <stdint.h>
+
+// heap health for /diag/heap. free heap, the biggest block malloc could
+// hand out and the core's fragmentation figure are read once a second.
+// the worst of each since boot is kept, and every HEAP_INTERVAL ms the
+// worst of that interval goes into a ring of HEAP_SAMPLES, so a slow
+// leak or creeping fragmentation shows up as a trend over days. the
+// uptime is kept here too, added up a second at a time so it goes on
+// past millis() wrapping at 49.7 days
+
+struct heapstat_sample {
+  uint16_t freeheap;    // lowest seen in the interval, bytes (capped at 65535)
+  uint16_t maxblock;    // smallest biggest-free-block seen
+  uint8_t frag;         // highest fragmentation %
+};
+
+struct heapstat {
+  uint32_t freeheap;    // now
+  uint32_t maxblock;
+  uint8_t frag;
+  uint32_t minfree;     // worst since boot
+  uint32_t minblock;
+  uint8_t maxfrag;
+  uint32_t uptime;      // seconds since boot
+};
+
+void heapstat_tick(void);
+// seconds since boot as of now, rather than the last tick
+uint32_t heapstat_uptime(void);
+void heapstat_get(heapstat *out);
+int heapstat_count(void);
+bool heapstat_sample_get(int i, heapstat_sample *dest);
+
+#endif
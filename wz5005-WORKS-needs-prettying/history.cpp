@@ -0,0 +1,106 @@
+#include "history.hpp"
+#include "settings.h"
+#include <stdint.h>
+#include "Arduino.h"
+
+// bit layout of a record, 13 bits covers MAX_VOLTAGE and MAX_CURRENT.
+// 52-59 are free, the temperature was to go there but nothing reads it
+#define H_BITS  13
+#define H_MASK  ((1u << H_BITS) - 1)
+#define H_USET  0
+#define H_ISET  13
+#define H_UOUT  26
+#define H_IOUT  39
+#define H_CVCC  60
+#define H_ONOFF 61
+#define H_VALID 62
+
+static uint64_t ring[HISTORY_LEN];
+static int head = 0;              // next slot to write
+static int count = 0;
+static uint32_t newest = 0;       // millis() of ring[head - 1]
+static uint32_t lastsample = 0;    // when the newest record was due
+static bool started = false;
+
+static uint64_t clamp13(uint16_t v) {
+  return v > H_MASK ? H_MASK : v;
+}
+
+static void history_push(uint64_t r) {
+  ring[head] = r;
+  head = (head + 1) % HISTORY_LEN;
+  if (count < HISTORY_LEN) {
+    count++;
+  }
+}
+
+// on a fixed schedule rather than HISTORY_INTERVAL after whenever the
+// last one happened to run, so a record really was taken at newest - k *
+// HISTORY_INTERVAL. a slot loop() missed altogether goes in empty instead
+// of sliding every older record along. the schedule starts at the first
+// call, the time setup() took isnt a gap
+void history_tick(void) {
+  if (!started) {
+    started = true;
+    lastsample = millis();
+  }
+  uint32_t late = millis() - lastsample;
+  if (late < HISTORY_INTERVAL) {
+    return;
+  }
+  for (int i = 0; late >= 2 * HISTORY_INTERVAL && i < HISTORY_LEN; i++) {
+    history_push(0);
+    lastsample += HISTORY_INTERVAL;
+    late -= HISTORY_INTERVAL;
+  }
+  if (late >= 2 * HISTORY_INTERVAL) {
+    lastsample = millis() - HISTORY_INTERVAL;   // gone for longer than the ring
+  }
+  lastsample += HISTORY_INTERVAL;
+
+  const dps_status *dps = dps_snapshot();
+  uint64_t r = 0;
+  if (dps && dps->stamp && millis() - dps->stamp < DPS_DEV_TIMEOUT) {
+    r |= clamp13(dps->uset) << H_USET;
+    r |= clamp13(dps->iset) << H_ISET;
+    r |= clamp13(dps->uout) << H_UOUT;
+    r |= clamp13(dps->iout) << H_IOUT;
+    r |= (uint64_t)(dps->cvcc ? 1 : 0) << H_CVCC;
+    r |= (uint64_t)(dps->onoff ? 1 : 0) << H_ONOFF;
+    r |= (uint64_t)1 << H_VALID;
+  }
+  history_push(r);
+  newest = lastsample;
+}
+
+int history_count(void) {
+  return count;
+}
+
+// index (0 = oldest) of the first sample taken at or after since
+int history_find(uint32_t since) {
+  if (count == 0 || (int32_t)(newest - since) < 0) {
+    return count;
+  }
+  uint32_t back = (newest - since) / HISTORY_INTERVAL;
+  if (back >= (uint32_t)count) {
+    return 0;
+  }
+  return count - 1 - back;
+}
+
+bool history_get(int i, history_sample *dest) {
+  if (i < 0 || i >= count) {
+    return false;
+  }
+  uint64_t r = ring[(head - count + i + HISTORY_LEN) % HISTORY_LEN];
+  dest->t = newest - (uint32_t)(count - 1 - i) * HISTORY_INTERVAL;
+  dest->uset = (r >> H_USET) & H_MASK;
+  dest->iset = (r >> H_ISET) & H_MASK;
+  dest->uout = (r >> H_UOUT) & H_MASK;
+  dest->iout = (r >> H_IOUT) & H_MASK;
+  dest->cvcc = (r >> H_CVCC) & 1;
+  dest->onoff = (r >> H_ONOFF) & 1;
+  dest->valid = (r >> H_VALID) & 1;
+  return true;
+}
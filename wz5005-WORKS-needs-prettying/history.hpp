@@ -0,0 +1,28 @@
+#ifndef __HISTORY__
+#define __HISTORY__
+
+#include <stdint.h>
+#include "dps.hpp"
+
+// sample ring kept in ram so a fresh page (or a second tab) gets the last
+// few minutes in one go instead of starting an empty chart. one record
+// per HISTORY_INTERVAL ms, 8 bytes each, the time of a record falls out
+// of its position so it isnt stored
+
+struct history_sample {
+  uint32_t t;           // millis() the sample was taken
+  uint16_t uset;
+  uint16_t iset;
+  uint16_t uout;
+  uint16_t iout;
+  uint8_t cvcc;
+  uint8_t onoff;
+  uint8_t valid;        // 0 when the supply wasnt answering at the time
+};
+
+void history_tick(void);
+int history_count(void);
+int history_find(uint32_t since);
+bool history_get(int i, history_sample *dest);
+
+#endif
@@ -0,0 +1,226 @@
+#include "metrics.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include <ESP8266WiFi.h>
+#include "dps.hpp"
+#include "heapstat.hpp"
+#include "prof.hpp"
+#include "settings.h"
+
+#define METRIC_LINE 112             // longest line, under the DOWNLOAD_MIN - 8 fill() is always given
+
+// replies by status, anything else counts as the last one
+static const uint16_t codes[] = { 200, 304, 400, 404, 409, 500, 503, 0 };
+static uint32_t responses[sizeof(codes) / sizeof(codes[0])];
+
+void metrics_response(int code) {
+  size_t i = 0;
+  while (codes[i] && codes[i] != code) {
+    i++;
+  }
+  responses[i]++;
+}
+
+// v with decimals digits after the point, without floats
+static int fixed(char *out, uint32_t v, int decimals) {
+  if (decimals == 0) {
+    return sprintf(out, "%lu", (unsigned long)v);
+  }
+  uint32_t div = decimals == 2 ? 100 : decimals == 3 ? 1000 : 1000000;
+  return sprintf(out, decimals == 2 ? "%lu.%02lu" : decimals == 3 ? "%lu.%03lu" : "%lu.%06lu",
+                 (unsigned long)(v / div), (unsigned long)(v % div));
+}
+
+// one sample line of a family, into out. -1 once i is past the last one
+typedef int (*metric_fn)(const char *name, uint8_t arg, int i, char *out);
+
+// dps_status fields per supply, arg says which
+enum { M_USET, M_ISET, M_UOUT, M_IOUT, M_ON, M_CC, M_PROTECT, M_AGE };
+
+static int m_supply(const char *name, uint8_t arg, int i, char *out) {
+  uint8_t addrs[DPS_DEVICES];
+  if (i >= dps_devices(addrs, DPS_DEVICES)) {
+    return -1;
+  }
+  const dps_status *s = dps_snapshot(addrs[i]);
+  int n = sprintf(out, "%s{dev=\"%u\"} ", name, addrs[i]);
+  switch (arg) {
+  case M_USET:    n += fixed(out + n, s->uset, 2); break;
+  case M_ISET:    n += fixed(out + n, s->iset, 3); break;
+  case M_UOUT:    n += fixed(out + n, s->uout, 2); break;
+  case M_IOUT:    n += fixed(out + n, s->iout, 3); break;
+  case M_ON:      n += fixed(out + n, s->onoff != 0, 0); break;
+  case M_CC:      n += fixed(out + n, s->cvcc != 0, 0); break;
+  case M_PROTECT: n += fixed(out + n, s->protect != 0, 0); break;
+  default:        n += fixed(out + n, millis() - s->stamp, 3); break;
+  }
+  out[n++] = '\n';
+  return n;
+}
+
+// dps_stats counters, arg says which
+enum { L_FRAMES, L_BADSUM, L_RESYNCS, L_SKIPPED, L_OVERFLOWS, L_TIMEOUTS, L_RETRIES, L_GIVEUPS };
+
+static uint32_t dps_stats::*const links[] = {
+  &dps_stats::frames, &dps_stats::badsum, &dps_stats::resyncs, &dps_stats::skipped,
+  &dps_stats::overflows, &dps_stats::timeouts, &dps_stats::retries, &dps_stats::giveups,
+};
+
+static int m_link(const char *name, uint8_t arg, int i, char *out) {
+  if (i) {
+    return -1;
+  }
+  dps_stats st;
+  dps_stats_get(&st);
+  return sprintf(out, "%s %lu\n", name, (unsigned long)(st.*links[arg]));
+}
+
+static const struct {
+  const char *code;
+  uint32_t dps_stats::*count;
+} acks[] = {
+  { "ok", &dps_stats::acks },
+  { "badtxchksm", &dps_stats::badtxchksm },
+  { "badcmndorovrflw", &dps_stats::badcmndorovrflw },
+  { "badcmndcntexec", &dps_stats::badcmndcntexec },
+  { "invalidcmd", &dps_stats::invalidcmd },
+  { "unknowncmd", &dps_stats::unknowncmd },
+  { "other", &dps_stats::othererr },
+};
+
+static int m_acks(const char *name, uint8_t, int i, char *out) {
+  if (i >= (int)(sizeof(acks) / sizeof(acks[0]))) {
+    return -1;
+  }
+  dps_stats st;
+  dps_stats_get(&st);
+  return sprintf(out, "%s{code=\"%s\"} %lu\n", name, acks[i].code, (unsigned long)(st.*acks[i].count));
+}
+
+static int m_responses(const char *name, uint8_t, int i, char *out) {
+  if (i >= (int)(sizeof(codes) / sizeof(codes[0]))) {
+    return -1;
+  }
+  if (codes[i]) {
+    return sprintf(out, "%s{code=\"%u\"} %lu\n", name, codes[i], (unsigned long)responses[i]);
+  }
+  return sprintf(out, "%s{code=\"other\"} %lu\n", name, (unsigned long)responses[i]);
+}
+
+// a summary per prof.hpp region, 4 lines each: p50, p99, _sum, _count
+static int m_latency(const char *name, uint8_t, int i, char *out) {
+  prof_region p;
+  if (!prof_get(i / 4, &p)) {
+    return -1;
+  }
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  const char *region = prof_name(i / 4);
+  int n;
+  switch (i % 4) {
+  case 0:
+  case 1:
+    n = sprintf(out, "%s{region=\"%s\",quantile=\"%s\"} ", name, region, i % 4 ? "0.99" : "0.5");
+    n += fixed(out + n, prof_percentile(&p, i % 4 ? 990 : 500) / mhz, 6);
+    break;
+  case 2: {
+    // to the ms, kept 64 bit. 2^32 ms is only 49 days in one region
+    uint64_t ms = p.sum / mhz / 1000;
+    n = sprintf(out, "%s_sum{region=\"%s\"} %lu.%03lu", name, region,
+                (unsigned long)(ms / 1000), (unsigned long)(ms % 1000));
+    break;
+  }
+  default:
+    n = sprintf(out, "%s_count{region=\"%s\"} %lu", name, region, (unsigned long)p.count);
+    break;
+  }
+  out[n++] = '\n';
+  return n;
+}
+
+enum { M_FREE, M_BLOCK, M_FRAG, M_MINFREE, M_RSSI, M_UPTIME };
+
+static int m_system(const char *name, uint8_t arg, int i, char *out) {
+  if (i) {
+    return -1;
+  }
+  heapstat h;
+  heapstat_get(&h);
+  long v;
+  switch (arg) {
+  case M_FREE:    v = h.freeheap; break;
+  case M_BLOCK:   v = h.maxblock; break;
+  case M_FRAG:    v = h.frag; break;
+  case M_MINFREE: v = h.minfree; break;
+  case M_RSSI:    v = WiFi.RSSI(); break;
+  default:        v = h.uptime; break;
+  }
+  return sprintf(out, "%s %ld\n", name, v);
+}
+
+struct metric_family {
+  const char *name;
+  const char *type;
+  const char *help;
+  metric_fn fn;
+  uint8_t arg;
+};
+
+static const metric_family families[] = {
+  { "wz5005_set_volts", "gauge", "Voltage setpoint.", m_supply, M_USET },
+  { "wz5005_set_amps", "gauge", "Current limit.", m_supply, M_ISET },
+  { "wz5005_output_volts", "gauge", "Measured output voltage.", m_supply, M_UOUT },
+  { "wz5005_output_amps", "gauge", "Measured output current.", m_supply, M_IOUT },
+  { "wz5005_output_on", "gauge", "1 when the output is on.", m_supply, M_ON },
+  { "wz5005_constant_current", "gauge", "1 in constant current, 0 in constant voltage.", m_supply, M_CC },
+  { "wz5005_protect", "gauge", "1 when a protection has tripped.", m_supply, M_PROTECT },
+  { "wz5005_reply_age_seconds", "gauge", "Time since the supply last answered.", m_supply, M_AGE },
+  { "wz5005_uart_frames_total", "counter", "Good frames received.", m_link, L_FRAMES },
+  { "wz5005_uart_bad_checksum_total", "counter", "Frames dropped for a bad checksum.", m_link, L_BADSUM },
+  { "wz5005_uart_resyncs_total", "counter", "Times the decoder found a header inside a bad frame.", m_link, L_RESYNCS },
+  { "wz5005_uart_skipped_bytes_total", "counter", "Bytes thrown away hunting for a header.", m_link, L_SKIPPED },
+  { "wz5005_uart_overflows_total", "counter", "Bytes lost to a full receive ring.", m_link, L_OVERFLOWS },
+  { "wz5005_uart_timeouts_total", "counter", "Requests that got no reply.", m_link, L_TIMEOUTS },
+  { "wz5005_uart_acks_total", "counter", "Acks from the supplies by code.", m_acks, 0 },
+  { "wz5005_set_retries_total", "counter", "Sets sent again after an error or timeout.", m_link, L_RETRIES },
+  { "wz5005_set_giveups_total", "counter", "Sets dropped after every retry failed.", m_link, L_GIVEUPS },
+  { "wz5005_http_responses_total", "counter", "HTTP replies by status.", m_responses, 0 },
+  { "wz5005_latency_seconds", "summary", "Time spent per region, handlers and uart round trips.", m_latency, 0 },
+  { "wz5005_heap_free_bytes", "gauge", "Free heap.", m_system, M_FREE },
+  { "wz5005_heap_max_block_bytes", "gauge", "Biggest block malloc can hand out.", m_system, M_BLOCK },
+  { "wz5005_heap_fragmentation_percent", "gauge", "Heap fragmentation.", m_system, M_FRAG },
+  { "wz5005_heap_min_free_bytes", "gauge", "Lowest free heap since boot.", m_system, M_MINFREE },
+  { "wz5005_wifi_rssi_dbm", "gauge", "WiFi signal strength.", m_system, M_RSSI },
+  { "wz5005_uptime_seconds", "counter", "Time since boot.", m_system, M_UPTIME },
+};
+
+#define FAMILIES (int)(sizeof(families) / sizeof(families[0]))
+
+size_t metrics_fill(download *d, uint8_t *buf, size_t len) {
+  size_t n = 0;
+  char line[METRIC_LINE + 8];
+  while (d->part < FAMILIES) {
+    const metric_family *f = &families[d->part];
+    int r;
+    if (d->pos == 0) {
+      r = sprintf(line, "# HELP %s %s\n", f->name, f->help);
+    } else if (d->pos == 1) {
+      r = sprintf(line, "# TYPE %s %s\n", f->name, f->type);
+    } else {
+      r = f->fn(f->name, f->arg, d->pos - 2, line);
+    }
+    if (r < 0) {
+      d->part++;
+      d->pos = 0;
+      continue;
+    }
+    if (n + r > len) {
+      break;
+    }
+    memcpy(buf + n, line, r);
+    n += r;
+    d->pos++;
+  }
+  return n;
+}
@@ -0,0 +1,21 @@
+#ifndef __METRICS__
+#define __METRICS__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "downloads.hpp"
+
+// /metrics in the prometheus text format, for the monitoring to scrape.
+// everything comes from counters and snapshots that are kept anyway, so
+// a scrape never asks the supplies anything and never mallocs. it is
+// rendered a line at a time straight into the download buffer by
+// metrics_fill(), as chunks from loop() like /history
+
+// the sketch calls this for every reply it writes
+void metrics_response(int code);
+
+// fill() for a chunked download, d->part is the metric family and d->pos
+// the line in it
+size_t metrics_fill(download *d, uint8_t *buf, size_t len);
+
+#endif
@@ -0,0 +1,235 @@
+#include "modbus.hpp"
+#include <stdint.h>
+#include <string.h>
+#include "Arduino.h"
+#include <ESP8266WiFi.h>
+#include "dps.hpp"
+#include "settings.h"
+
+// exception codes
+#define MB_ILLEGAL_FUNCTION  0x01
+#define MB_ILLEGAL_ADDRESS   0x02
+#define MB_ILLEGAL_VALUE     0x03
+#define MB_BUSY              0x06
+#define MB_NO_RESPONSE       0x0B   // gateway target device failed to respond
+
+static uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+  *p++ = v >> 8;
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+int modbus_length(const uint8_t *buf, size_t have) {
+  if (have < 6) {
+    return 0;
+  }
+  uint16_t len = get16(buf + 4);   // unit id and pdu
+  if (get16(buf + 2) != 0 || len < 2 || len > MODBUS_FRAME - 6) {
+    return -1;                      // protocol id isnt modbus, or too big
+  }
+  return 6 + len;
+}
+
+static uint16_t modbus_reg(const dps_status *s, int reg) {
+  switch (reg) {
+  case MB_USET:      return s->uset;
+  case MB_ISET:      return s->iset;
+  case MB_UOUT:      return s->uout;
+  case MB_IOUT:      return s->iout;
+  case MB_POWER:     return (uint32_t)s->uout * s->iout / 1000;
+  case MB_LOCK:      return s->lock;
+  case MB_PROTECT:   return s->protect;
+  case MB_CVCC:      return s->cvcc;
+  case MB_ONOFF:     return s->onoff;
+  case MB_MODEL:     return 5005;
+  case MB_AGE: {
+    uint32_t age = (millis() - s->stamp) / 100;
+    return age > 0xFFFF ? 0xFFFF : age;
+  }
+  default:           return 0;
+  }
+}
+
+// 0 if v can go in reg, else the exception
+static uint8_t modbus_check(int reg, int v) {
+  switch (reg) {
+  case MB_USET:  return v >= MIN_VOLTAGE && v < MAX_VOLTAGE ? 0 : MB_ILLEGAL_VALUE;
+  case MB_ISET:  return v >= MIN_CURRENT && v < MAX_CURRENT ? 0 : MB_ILLEGAL_VALUE;
+  case MB_LOCK:
+  case MB_ONOFF: return v <= 1 ? 0 : MB_ILLEGAL_VALUE;
+  default:       return MB_ILLEGAL_ADDRESS;
+  }
+}
+
+// put the writes for regs at..at+n on the queue, uset and iset together
+// as one frame when both are there. false when the queue is full
+static bool modbus_write(uint8_t addr, int at, int n, const uint8_t *vals) {
+  bool ok = true;
+  for (int i = 0; i < n; i++) {
+    int reg = at + i;
+    uint16_t v = get16(vals + i * 2);
+    if (reg == MB_USET && i + 1 < n) {
+      ok &= dps_set_voltage_current(v, get16(vals + i * 2 + 2), addr);
+      i++;
+    } else if (reg == MB_USET) {
+      ok &= dps_set_voltage(v, addr);
+    } else if (reg == MB_ISET) {
+      ok &= dps_set_current(v, addr);
+    } else if (reg == MB_LOCK) {
+      ok &= dps_set_mode(v != 0, addr);
+    } else {
+      ok &= dps_set_output(v != 0, addr);
+    }
+  }
+  return ok;
+}
+
+static size_t modbus_exception(uint8_t *reply, uint8_t fn, uint8_t code) {
+  reply[7] = fn | 0x80;
+  reply[8] = code;
+  put16(reply + 4, 3);
+  return 9;
+}
+
+size_t modbus_frame(const uint8_t *req, size_t len, uint8_t *reply) {
+  memcpy(reply, req, 7);            // transaction, protocol and unit go back as they came
+  uint8_t fn = req[7];
+  uint8_t unit = req[6];
+  uint8_t addr = unit == 0 || unit == 0xFF ? wz5005::DEFAULT_ADDR : unit;
+  const dps_status *s = dps_snapshot(addr);
+  if (fn != 0x03 && fn != 0x04 && fn != 0x06 && fn != 0x10) {
+    return modbus_exception(reply, fn, MB_ILLEGAL_FUNCTION);
+  }
+  if (len < 12) {
+    return modbus_exception(reply, fn, MB_ILLEGAL_VALUE);
+  }
+  if (!s || !s->stamp) {
+    return modbus_exception(reply, fn, MB_NO_RESPONSE);
+  }
+  int at = get16(req + 8);
+
+  if (fn == 0x03 || fn == 0x04) {
+    int n = get16(req + 10);
+    if (n < 1 || n > 125) {
+      return modbus_exception(reply, fn, MB_ILLEGAL_VALUE);
+    }
+    if (at + n > MB_REGS) {
+      return modbus_exception(reply, fn, MB_ILLEGAL_ADDRESS);
+    }
+    uint8_t *p = reply + 7;
+    *p++ = fn;
+    *p++ = n * 2;
+    for (int i = 0; i < n; i++) {
+      p = put16(p, modbus_reg(s, at + i));
+    }
+    put16(reply + 4, p - reply - 6);
+    return p - reply;
+  }
+
+  int n = 1;
+  const uint8_t *vals = req + 10;
+  if (fn == 0x10) {
+    n = get16(req + 10);
+    if (n < 1 || n > 123 || len < 13 || req[12] != n * 2 || len < 13 + (size_t)n * 2) {
+      return modbus_exception(reply, fn, MB_ILLEGAL_VALUE);
+    }
+    vals = req + 13;
+  }
+  // nothing goes on the queue unless every value is good
+  for (int i = 0; i < n; i++) {
+    uint8_t e = modbus_check(at + i, get16(vals + i * 2));
+    if (e) {
+      return modbus_exception(reply, fn, e);
+    }
+  }
+  if (!modbus_write(addr, at, n, vals)) {
+    return modbus_exception(reply, fn, MB_BUSY);
+  }
+  // 0x06 echoes the request, 0x10 gives back the address and count
+  memcpy(reply + 7, req + 7, 5);
+  put16(reply + 4, 6);
+  return 12;
+}
+
+#if MODBUS_PORT
+static WiFiServer listener(MODBUS_PORT);
+
+struct modbusClient {
+  WiFiClient client;
+  uint8_t buf[MODBUS_FRAME];
+  uint16_t have;
+  uint32_t seen;        // millis() of the last byte
+};
+
+static modbusClient masters[MODBUS_CLIENTS];
+
+void modbus_begin(void) {
+  listener.begin();
+  listener.setNoDelay(true);
+}
+
+void modbus_tick(void) {
+  WiFiClient fresh = listener.accept();
+  if (fresh) {
+    int slot = -1;
+    for (int i = 0; i < MODBUS_CLIENTS; i++) {
+      if (!masters[i].client.connected()) {
+        slot = i;
+        break;
+      }
+    }
+    if (slot < 0) {
+      fresh.stop();                 // full up, they can try again
+    } else {
+      masters[slot].client = fresh;
+      masters[slot].have = 0;
+      masters[slot].seen = millis();
+    }
+  }
+
+  uint8_t reply[MODBUS_FRAME];
+  for (int i = 0; i < MODBUS_CLIENTS; i++) {
+    modbusClient *m = &masters[i];
+    if (!m->client.connected()) {
+      continue;
+    }
+    if (m->client.available() > 0 && m->have < sizeof(m->buf)) {
+      int got = m->client.read(m->buf + m->have, sizeof(m->buf) - m->have);
+      if (got > 0) {
+        m->have += got;
+        m->seen = millis();
+      }
+    }
+    // silent, or not reading its replies so its requests have backed up
+    // and nothing more is taken from it
+    if (millis() - m->seen > MODBUS_IDLE) {
+      m->client.stop();
+      continue;
+    }
+    // a master may send several requests without waiting. each one is
+    // only taken once the biggest reply fits in the send buffer, a write
+    // that has to wait for acks would hold up loop()
+    int len;
+    while ((len = modbus_length(m->buf, m->have)) > 0 && len <= m->have &&
+           m->client.availableForWrite() >= sizeof(reply)) {
+      size_t n = modbus_frame(m->buf, len, reply);
+      m->client.write(reply, n);
+      memmove(m->buf, m->buf + len, m->have - len);
+      m->have -= len;
+    }
+    if (len < 0) {
+      m->client.stop();
+    }
+  }
+}
+#else
+void modbus_begin(void) {
+}
+
+void modbus_tick(void) {
+}
+#endif
@@ -0,0 +1,47 @@
+#ifndef __MODBUS__
+#define __MODBUS__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// modbus-tcp in front of the poller. the unit id is the supply's bus
+// address (0 and 255, which masters use for "the gateway", mean the
+// default one) and its registers are laid out like the dps5005 ones the
+// bens_scripts tools already speak:
+//
+//   0 uset 0.01V rw   4 power 0.01W      8 cv/cc           12 version
+//   1 iset 1mA   rw   5 spare, 0         9 on/off rw       13 spare, 0
+//   2 uout 0.01V      6 lock (remote) rw 10 backlight      14 reply age 0.1s
+//   3 iout 1mA        7 protect          11 model 5005
+//
+// reads (0x03/0x04) come from the poller's snapshot, so any number of
+// masters asking as often as they like never adds a frame on the bus.
+// writes (0x06/0x10) go on the command queue like the http sets, the
+// reply means queued. a supply that isnt answering gets exception 0x0B,
+// a full queue 0x06. the supply cant be asked for its mode, lock reads
+// back whatever it last acked a 0x20 for. 5 was to be the input voltage
+// and 13 the temperature, no reply the poller asks for carries either,
+// so both stay 0 and are only there to keep the dps5005 layout
+
+#define MODBUS_CLIENTS  4           // masters connected at once
+#define MODBUS_FRAME    260         // mbap header and the biggest pdu
+#define MODBUS_IDLE     60000       // ms a master can sit silent, or not read, before it is dropped
+
+enum {
+  MB_USET, MB_ISET, MB_UOUT, MB_IOUT, MB_POWER, MB_SPARE_UIN, MB_LOCK, MB_PROTECT,
+  MB_CVCC, MB_ONOFF, MB_BACKLIGHT, MB_MODEL, MB_VERSION, MB_SPARE_TEMP, MB_AGE, MB_REGS
+};
+
+// bytes of the adu starting at buf once the header is in, 0 before
+// that. -1 when the header is nonsense and the connection should go
+int modbus_length(const uint8_t *buf, size_t have);
+// one whole request adu in, its reply (MODBUS_FRAME at most) out.
+// returns the reply length
+size_t modbus_frame(const uint8_t *req, size_t len, uint8_t *reply);
+
+// listen on MODBUS_PORT and serve whoever connects, from loop(). does
+// nothing unless settings.h gives a port
+void modbus_begin(void);
+void modbus_tick(void);
+
+#endif
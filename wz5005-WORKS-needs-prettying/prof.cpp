@@ -0,0 +1,48 @@
+#include "prof.hpp"
+#include <stdint.h>
+#include <string.h>
+
+#if PROF_ENABLED
+prof_region prof_regions[PROF_REGIONS];
+#endif
+
+static const char *const names[PROF_REGIONS] = {
+  "loop", "status", "status.bin", "set", "files", "history", "render", "flash", "tlog",
+  "uart_status", "uart_output", "uart_setpoints", "uart_set",
+};
+
+const char *prof_name(int r) {
+  return r >= 0 && r < PROF_REGIONS ? names[r] : "";
+}
+
+bool prof_get(int r, prof_region *dest) {
+#if PROF_ENABLED
+  if (r >= 0 && r < PROF_REGIONS) {
+    memcpy(dest, &prof_regions[r], sizeof(*dest));
+    return true;
+  }
+#endif
+  (void)r;
+  (void)dest;
+  return false;
+}
+
+// ranked against what is in hist[], not count, the halving leaves hist
+// summing to less than that
+uint32_t prof_percentile(const prof_region *p, int permille) {
+  uint32_t total = 0;
+  for (int i = 0; i < PROF_BUCKETS; i++) {
+    total += p->hist[i];
+  }
+  uint32_t want = (total * permille + 999) / 1000;
+  uint32_t seen = 0;
+  for (int i = 0; i < PROF_BUCKETS; i++) {
+    seen += p->hist[i];
+    if (seen >= want && seen) {
+      // the top of the bucket can be past anything ever seen
+      uint32_t top = i == 31 ? 0xFFFFFFFF : (2UL << i) - 1;
+      return top < p->max ? top : p->max;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef __PROF__
+#define __PROF__
+
+#include <stdint.h>
+#include "Arduino.h"
+
+// where the time goes, for /diag/latency. a PROF_SCOPE(region) at the
+// top of a block counts the cpu cycles until the block ends into that
+// region's histogram, bucket b is [2^b, 2^(b+1)) cycles. that is two
+// reads of the cycle counter, a count leading zeros and an increment,
+// well under a microsecond. -DPROF_ENABLED=0 takes all of it out
+
+#ifndef PROF_ENABLED
+#define PROF_ENABLED 1
+#endif
+#define PROF_BUCKETS 32
+
+enum {
+  PROF_LOOP,            // all of loop()
+  PROF_STATUS,          // the handlers
+  PROF_STATUS_BIN,
+  PROF_SET,             // uset, iset, onoff, offon
+  PROF_FILES,
+  PROF_HISTORY,
+  PROF_RENDER,          // renderStatus(), the json
+  PROF_FLASH,           // a read from a file being downloaded
+  PROF_TLOG,            // a page of the flash log written out, rotation and all
+  PROF_UART_STATUS,     // request out to reply in, per command
+  PROF_UART_OUTPUT,
+  PROF_UART_SETPOINTS,
+  PROF_UART_SET,        // any set, answered by an ack
+  PROF_REGIONS
+};
+
+struct prof_region {
+  uint32_t count;
+  uint32_t max;         // cycles
+  uint64_t sum;         // of every sample, never halved
+  uint16_t hist[PROF_BUCKETS];
+};
+
+#if PROF_ENABLED
+extern prof_region prof_regions[PROF_REGIONS];
+
+// a full bucket halves them all, like dps_lat does, so the shape stays
+// and recent samples count more than old ones
+static inline void prof_add(uint8_t r, uint32_t cycles) {
+  prof_region *p = &prof_regions[r];
+  uint8_t b = 31 - __builtin_clz(cycles | 1);
+  if (p->hist[b] == 0xFFFF) {
+    for (int i = 0; i < PROF_BUCKETS; i++) {
+      p->hist[i] >>= 1;
+    }
+  }
+  p->hist[b]++;
+  p->count++;
+  p->sum += cycles;
+  if (cycles > p->max) {
+    p->max = cycles;
+  }
+}
+
+struct prof_scope {
+  uint8_t r;
+  uint32_t start;
+  prof_scope(uint8_t r) : r(r), start(ESP.getCycleCount()) {}
+  ~prof_scope() { prof_add(r, ESP.getCycleCount() - start); }
+};
+
+#define PROF_CAT2(a, b) a##b
+#define PROF_CAT(a, b) PROF_CAT2(a, b)
+#define PROF_SCOPE(r) prof_scope PROF_CAT(prof_, __LINE__)(r)
+#define PROF_ADD(r, cycles) prof_add(r, cycles)
+#else
+#define PROF_SCOPE(r) do {} while (0)
+#define PROF_ADD(r, cycles) do {} while (0)
+#endif
+
+const char *prof_name(int r);
+// a copy of region r, false when there is no such region or PROF_ENABLED is 0
+bool prof_get(int r, prof_region *dest);
+// cycles at or below which a permille of the samples in p fall, the top
+// of the bucket it lands in or max if that is lower
+uint32_t prof_percentile(const prof_region *p, int permille);
+
+#endif
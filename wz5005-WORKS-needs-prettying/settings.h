@@ -7,7 +7,31 @@
 #define MIN_CURRENT 0
 #define MAX_CURRENT 4999
 
+#define DPS_POLL_INTERVAL 100   // ms between background queries to the PSU
+#define DPS_DEVICES 4           // bus addresses to look for, starting at 1
+
+#define HISTORY_LEN 512         // samples kept for /history, 8 bytes each. 4KB
+#define HISTORY_INTERVAL 1000   // ms between samples
+
+#define TLOG_INTERVAL 10000     // ms between records in the flash log
+#define TLOG_FILE_SIZE 65536    // bytes before /log0.bin is rotated
+#define TLOG_FILES 4            // /log0.bin .. /log3.bin
+
+#define HEAP_INTERVAL 3600000   // ms per /diag/heap sample, worst of the hour
+#define HEAP_SAMPLES 168        // a week of them, 6 bytes each
+
 #define MDSN_NAME "wz5005"
+// modbus-tcp, 502 is the usual port. off (0) unless set, a master can
+// write the setpoints and switch the output with no login
+#ifndef MODBUS_PORT
+#define MODBUS_PORT 0
+#endif
+// raw psu frames on a tcp port, what setup_uart-wifi_bridge wants. off
+// (0) unless set, anyone who can reach it can send the supply anything
+// with no login. 23 is what the bens_scripts bridge tools expect
+#ifndef BRIDGE_PORT
+#define BRIDGE_PORT 0
+#endif
 
 #define WIFI_SSID "maddocks"
 #define WIFI_PASSWORD "maddocks"
@@ -0,0 +1,141 @@
+#include "tlog.hpp"
+#include "dps.hpp"
+#include "heapstat.hpp"
+#include "prof.hpp"
+#include "settings.h"
+#include <stdint.h>
+#include <string.h>
+#include "Arduino.h"
+#include <FS.h>
+
+static tlog_record batch[TLOG_PAGE / sizeof(tlog_record)];
+static int fill = 0;
+static unsigned long lastlog = 0;
+static unsigned long lastenergy = 0;
+static uint64_t energy = 0;       // mW*ms, 3600000 of them make a mWh
+static bool held = false;
+
+void tlog_name(char *dest, int n) {
+  sprintf(dest, "/log%d.bin", n);
+}
+
+// move log0 to log1 and so on, whatever falls off the end is gone
+static void tlog_rotate(void) {
+  char from[16], to[16];
+  tlog_name(to, TLOG_FILES - 1);
+  SPIFFS.remove(to);
+  for (int i = TLOG_FILES - 2; i >= 0; i--) {
+    tlog_name(from, i);
+    tlog_name(to, i + 1);
+    if (SPIFFS.exists(from)) {
+      SPIFFS.rename(from, to);
+    }
+  }
+}
+
+static void tlog_append(const tlog_record &r) {
+  batch[fill++] = r;
+  if (fill == (int)(sizeof(batch) / sizeof(batch[0]))) {
+    tlog_flush();
+  }
+}
+
+// while a download has one of the files open they stay where they are,
+// /log0.bin just grows past TLOG_FILE_SIZE until it is let go
+void tlog_hold(bool hold) {
+  held = hold;
+}
+
+// bytes of 0xFF that bring f back onto a record, after a power cut left
+// part of one at its end
+static size_t tlog_torn(File &f) {
+  return (sizeof(tlog_record) - f.size() % sizeof(tlog_record)) % sizeof(tlog_record);
+}
+
+// bytes the batch takes on f after the torn ones. pad fills the rest of
+// the page /log0.bin is on with TLOG_MAGIC_PAD records, so a short batch
+// still goes out as one write that ends on a page and the next whole one
+// starts on one. a batch that doesnt fit in what is left of the page goes
+// out as it is, batch[] has no room for another page of padding
+static size_t tlog_len(File &f, bool pad) {
+  size_t len = pad ? TLOG_PAGE - (f.size() + tlog_torn(f)) % TLOG_PAGE : 0;
+  return len < fill * sizeof(tlog_record) ? fill * sizeof(tlog_record) : len;
+}
+
+static void tlog_write(bool pad) {
+  if (fill == 0) {
+    return;
+  }
+  PROF_SCOPE(PROF_TLOG);
+  char name[16];
+  tlog_name(name, 0);
+  File f = SPIFFS.open(name, "a");
+  if (f && !held && f.size() + tlog_torn(f) + tlog_len(f, pad) > TLOG_FILE_SIZE) {
+    f.close();
+    tlog_rotate();
+    f = SPIFFS.open(name, "a");
+  }
+  if (f) {
+    size_t len = tlog_len(f, pad);
+    size_t torn = tlog_torn(f);
+    if (torn) {
+      uint8_t erased[sizeof(tlog_record)];
+      memset(erased, 0xFF, torn);
+      f.write(erased, torn);
+    }
+    memset((uint8_t *)batch + fill * sizeof(tlog_record), 0xFF, len - fill * sizeof(tlog_record));
+    f.write((const uint8_t *)batch, len);
+    f.close();
+  }
+  fill = 0;
+}
+
+void tlog_flush(void) {
+  tlog_write(false);
+}
+
+// whatever is still waiting for a full page, so a download can tack it
+// on the end without forcing a short write
+const uint8_t *tlog_pending(int *len) {
+  *len = fill * sizeof(tlog_record);
+  return (const uint8_t *)batch;
+}
+
+void tlog_begin(void) {
+  tlog_record r = { TLOG_MAGIC_BOOT, 0, 0, 0, 0, 0 };
+  tlog_append(r);
+  // on flash now, a reset before the first page fills would lose it
+  tlog_write(true);
+  lastlog = lastenergy = millis();
+}
+
+void tlog_tick(void) {
+  unsigned long now = millis();
+  if (now - lastenergy < 1000) {
+    return;
+  }
+  const dps_status *dps = dps_snapshot();
+  if (dps && dps->stamp && dps->onoff) {
+    // uout is 10mV, iout mA, so uout*iout/100 is mW
+    energy += (uint64_t)dps->uout * dps->iout / 100 * (now - lastenergy);
+  }
+  lastenergy = now;
+
+  if (now - lastlog < TLOG_INTERVAL) {
+    return;
+  }
+  lastlog = now;
+  if (!dps || !dps->stamp) {
+    return;
+  }
+  // millis() / 1000 would go back to 0 after 49.7 days, heapstat keeps
+  // the uptime in 64 bits
+  tlog_record r;
+  r.t = heapstat_uptime();
+  r.uset = dps->uset;
+  r.iset = dps->iset;
+  r.uout = dps->uout;
+  r.iout = dps->iout;
+  r.mwh = (uint32_t)(energy / 3600000);
+  tlog_append(r);
+}
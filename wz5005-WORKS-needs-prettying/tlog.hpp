@@ -0,0 +1,32 @@
+#ifndef __TLOG__
+#define __TLOG__
+
+#include <stdint.h>
+
+// telemetry log on SPIFFS that survives a reboot. fixed 16 byte records
+// are gathered in ram and written a whole flash page at a time, the
+// current file is /log0.bin and gets shifted to /log1.bin.. when full.
+// a flush is timed as PROF_TLOG on /diag/latency. the BOOT record goes
+// out at once with the rest of its page padded, so writes stay on pages
+
+#define TLOG_PAGE       256         // SPIFFS page, one write per page
+#define TLOG_MAGIC_BOOT 0x544F4F42  // "BOOT" in t, marks a restart
+#define TLOG_MAGIC_PAD  0xFFFFFFFF  // t of the padding after BOOT, skip it
+
+struct tlog_record {
+  uint32_t t;           // seconds since boot, TLOG_MAGIC_BOOT or TLOG_MAGIC_PAD
+  uint16_t uset;
+  uint16_t iset;
+  uint16_t uout;
+  uint16_t iout;
+  uint32_t mwh;         // energy delivered since boot
+};
+
+void tlog_begin(void);
+void tlog_tick(void);
+void tlog_flush(void);
+void tlog_hold(bool hold);
+const uint8_t *tlog_pending(int *len);
+void tlog_name(char *dest, int n);
+
+#endif
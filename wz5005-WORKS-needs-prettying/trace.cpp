@@ -0,0 +1,48 @@
+#include "trace.hpp"
+#include <stdint.h>
+#include "Arduino.h"
+
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+static trace_rec ring[TRACE_LEN];
+static uint32_t next = 0;
+
+void trace_put(uint16_t id, uint16_t a, uint16_t b, uint16_t c, uint16_t d) {
+  trace_rec *r = &ring[next & (TRACE_LEN - 1)];
+  r->t = micros();
+  r->id = id;
+  r->seq = (uint16_t)next;
+  r->arg[0] = a;
+  r->arg[1] = b;
+  r->arg[2] = c;
+  r->arg[3] = d;
+  next++;
+}
+
+uint32_t trace_next(void) {
+  return next;
+}
+
+uint32_t trace_first(void) {
+  return next > TRACE_LEN ? next - TRACE_LEN : 0;
+}
+
+bool trace_get(uint32_t seq, trace_rec *dest) {
+  if (seq >= next || seq < trace_first()) {
+    return false;
+  }
+  *dest = ring[seq & (TRACE_LEN - 1)];
+  return true;
+}
+#else
+uint32_t trace_next(void) {
+  return 0;
+}
+
+uint32_t trace_first(void) {
+  return 0;
+}
+
+bool trace_get(uint32_t, trace_rec *) {
+  return false;
+}
+#endif
@@ -0,0 +1,73 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <stdint.h>
+
+// what the poller has to say about the bus, without printing it. a line
+// on Serial at 9600 baud is ~1ms a char of blocking tx on the uart the
+// supply replies come in on, a trace is a 16 byte record put in a ram
+// ring, read out later over /diag/trace. call from loop() only, not isrs
+//
+// TRACE_LEVEL picks what gets built in. a TRACE_x() above it is gone
+// entirely, its args arent even evaluated, and -DTRACE_LEVEL=0 leaves
+// the ring out too
+
+#define TRACE_LEVEL_OFF    0
+#define TRACE_LEVEL_ERROR  1        // the bus misbehaving: timeouts, garbage, nacks, give ups
+#define TRACE_LEVEL_INFO   2        // what was done to the supplies and who came and went
+#define TRACE_LEVEL_DEBUG  3        // every stats frame
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+#define TRACE_LEN 256               // records kept, a power of 2. 4KB
+
+// the id says what the args are
+enum {
+  TR_BOOT = 1,          // (nothing) first record after a reset
+  TR_TIMEOUT,           // addr, cmd, the timeout it had in ms
+  TR_BADFRAME,          // bytes thrown away, 1 if a header was found further in
+  TR_NACK,              // addr, ack code, the command it was for
+  TR_RETRY,             // cmd, try
+  TR_GIVEUP,            // cmd, tries
+  TR_SEND,              // addr, cmd, a, b. every set that goes out
+  TR_FOUND,             // addr, a supply started answering
+  TR_LOST,              // addr, and stopped
+  TR_STATS,             // addr, first six arg bytes of a 0x2A reply as 3 big endian words
+  TR_BRIDGE,            // addr, cmd. a frame from the tcp bridge went out
+  TR_NOASSET,           // assets held, length of the path. a file on spiffs that isnt served
+};
+
+struct trace_rec {
+  uint32_t t;           // micros()
+  uint16_t id;
+  uint16_t seq;         // low 16 bits of its number, a reader can tell it was overwritten
+  uint16_t arg[4];
+};
+
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+void trace_put(uint16_t id, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0, uint16_t d = 0);
+#endif
+// number the next record will get, and the oldest one still in the ring
+uint32_t trace_next(void);
+uint32_t trace_first(void);
+// record seq, false once it has been overwritten or isnt there yet
+bool trace_get(uint32_t seq, trace_rec *dest);
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(...) trace_put(__VA_ARGS__)
+#else
+#define TRACE_ERROR(...) do {} while (0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(...) trace_put(__VA_ARGS__)
+#else
+#define TRACE_INFO(...) do {} while (0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(...) trace_put(__VA_ARGS__)
+#else
+#define TRACE_DEBUG(...) do {} while (0)
+#endif
+
+#endif
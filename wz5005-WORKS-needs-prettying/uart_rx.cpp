@@ -0,0 +1,74 @@
+#include "uart_rx.hpp"
+#include <stdint.h>
+#include "Arduino.h"
+#ifdef ESP8266
+#include "esp8266_peri.h"
+#endif
+
+static volatile uint8_t ring[UART_RX_LEN];
+static volatile uint32_t stamps[UART_RX_LEN];
+static volatile uint16_t head = 0;    // only the isr writes this
+static volatile uint16_t tail = 0;    // only loop() writes this
+static volatile uint32_t overflows = 0;
+
+static inline void IRAM_ATTR uart_rx_push(uint8_t c, uint32_t now) {
+  uint16_t next = (head + 1) & (UART_RX_LEN - 1);
+  if (next == tail) {
+    overflows++;
+    return;
+  }
+  ring[head] = c;
+  stamps[head] = now;
+  head = next;
+}
+
+#ifdef ESP8266
+
+// fires when the fifo passes the full threshold or, more usefully, when
+// the line has been quiet for the timeout after a burst, which for us is
+// the end of a reply. everything in the fifo gets the same stamp
+static void IRAM_ATTR uart_rx_isr(void *arg, void *frame) {
+  (void)arg;
+  (void)frame;
+  uint32_t status = USIS(0);
+  uint32_t now = micros();
+  while ((USS(0) >> USRXC) & 0xFF) {
+    uart_rx_push((uint8_t)USF(0), now);
+  }
+  USIC(0) = status;
+}
+
+void uart_rx_begin(void) {
+  ETS_UART_INTR_DISABLE();
+  USC1(0) = (64 << UCFFT) | (2 << UCTOT) | (1 << UCTOE);  // timeout is 2 byte times
+  USIC(0) = 0xFFFF;
+  USIE(0) = (1 << UIFF) | (1 << UITO) | (1 << UIOF);
+  ETS_UART_INTR_ATTACH(uart_rx_isr, NULL);
+  ETS_UART_INTR_ENABLE();
+}
+
+#else
+
+void uart_rx_begin(void) {
+}
+
+#endif
+
+bool uart_rx_read(uint8_t *c, uint32_t *stamp) {
+#ifndef ESP8266
+  while (Serial.available()) {
+    uart_rx_push((uint8_t)Serial.read(), micros());
+  }
+#endif
+  if (tail == head) {
+    return false;
+  }
+  *c = ring[tail];
+  *stamp = stamps[tail];
+  tail = (tail + 1) & (UART_RX_LEN - 1);
+  return true;
+}
+
+uint32_t uart_rx_overflows(void) {
+  return overflows;
+}
@@ -0,0 +1,20 @@
+#ifndef __UART_RX__
+#define __UART_RX__
+
+#include <stdint.h>
+
+// PSU receive side. on the ESP8266 our own ISR drains the UART0 rx fifo
+// into a single producer / single consumer ring and stamps every byte
+// with micros(), loop() pulls them out with uart_rx_read(). anywhere else
+// uart_rx_read() just drains Serial and stamps on the way through.
+//
+// this takes UART0 rx away from Serial, Serial.read() sees nothing after
+// uart_rx_begin(). tx (the debug prints) is not touched
+
+#define UART_RX_LEN 256     // power of 2
+
+void uart_rx_begin(void);
+bool uart_rx_read(uint8_t *c, uint32_t *stamp);
+uint32_t uart_rx_overflows(void);
+
+#endif
@@ -5,7 +5,18 @@
 #include <FS.h>
 #include <cstdlib>
 #include <stdint.h>
+#include "assets.hpp"
+#include "bridge.hpp"
+#include "downloads.hpp"
 #include "dps.hpp"
+#include "heapstat.hpp"
+#include "history.hpp"
+#include "metrics.hpp"
+#include "modbus.hpp"
+#include "prof.hpp"
+#include "trace.hpp"
+#include "tlog.hpp"
+#include "uart_rx.hpp"
 #include "settings.h"
 
 //SSID and Password of your WiFi router
@@ -16,17 +27,68 @@ ESP8266WebServer server(80); //Server on port 80
 File fsUploadFile; //holds the current upload
 
 
-export volatile int doupdateon = 0;
-export volatile int doupdateout = 0;
-
 #define LED_PIN 16
-static uint8_t recvd[20] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-static uint8_t recstart[20] = {0xAA, 0x01, 0x2B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xD6};
-static uint8_t setseven[20] = {0xAA, 0x01, 0x2C, 0x13, 0x88, 0x12, 0xAB, 0x02, 0xBC, 0x00, 0x04, 0x00, 0x00, 0x00, 0x42, 0x00, 0x00, 0x00, 0x00, 0x33};
-static uint8_t offoff[20] = {0xAA, 0x01, 0x22, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xCD};
-static uint8_t onon[20] = {0xAA, 0x01, 0x22, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xCE};
-uint8_t setupstart[] = {0xAA, 0x01, 0x20, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xCC}; // actually its enable remote
-uint8_t disableremote[] = {0xAA, 0x01, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xCC};
+
+// responses go straight to the client from here rather than thru send(),
+// which builds the status line and headers in a String on every call. a
+// handler renders its body into replyBody and reply() puts the headers
+// in front of it, so the whole thing is one write and one segment
+#define REPLY_HEAD 256
+#define REPLY_BODY 1024
+static char replyBuf[REPLY_HEAD + REPLY_BODY];
+static char *const replyBody = replyBuf + REPLY_HEAD;
+
+// the headers handleFiles() looks at, made once so asking for them doesnt
+// build a String each time (longer than the 11 chars String keeps inline)
+static const String hdrAcceptEncoding("Accept-Encoding");
+static const String hdrIfNoneMatch("If-None-Match");
+
+static const char *reason(int code) {
+  switch (code) {
+  case 200: return "OK";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 409: return "Conflict";
+  case 500: return "Internal Server Error";
+  default:  return "Service Unavailable";
+  }
+}
+
+// status line and headers into head, extra is more header lines (each
+// ending in \r\n) or NULL. len < 0 is a chunked body
+static int replyHead(char *head, int code, const char *type, long len, const char *extra) {
+  metrics_response(code);
+  int n = snprintf(head, REPLY_HEAD, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n%s",
+                   code, reason(code), type, extra ? extra : "");
+  if (len < 0) {
+    n += snprintf(head + n, REPLY_HEAD - n, "Transfer-Encoding: chunked\r\n");
+  } else {
+    n += snprintf(head + n, REPLY_HEAD - n, "Content-Length: %ld\r\n", len);
+  }
+  n += snprintf(head + n, REPLY_HEAD - n, "Connection: close\r\n\r\n");
+  return n < REPLY_HEAD ? n : REPLY_HEAD - 1;
+}
+
+// len bytes of body already in replyBody
+static void reply(int code, const char *type, int len) {
+  char head[REPLY_HEAD];
+  int n = replyHead(head, code, type, len, NULL);
+  memcpy(replyBody - n, head, n);
+  server.client().write((const uint8_t *)replyBody - n, n + len);
+}
+
+// just the headers, for a body that download_start() sends
+static void replyHeaders(int code, const char *type, long len, const char *extra) {
+  int n = replyHead(replyBuf, code, type, len, extra);
+  server.client().write((const uint8_t *)replyBuf, n);
+}
+
+// the {} every set and error answers with
+static void replyEmpty(int code) {
+  memcpy(replyBody, "{}", 2);
+  reply(code, "application/json", 2);
+}
 
 const char* status_fmt =
   "{\"uset\":%d,"
@@ -39,117 +101,635 @@ const char* status_fmt =
   "\"protect\":%d,"
   "\"cvcc\":%d,"
   "\"onoff\":%d,"
-  "\"offon\":%d}";
+  "\"offon\":%d,"
+  "\"stamp\":%lu,"
+  "\"age\":%lu}";
+
+// which supply on the bus a request is for, ?dev=N, 1 when left off
+uint8_t argDev() {
+  const String &value = server.arg("dev");
+  if (value.length() > 0) {
+    return (uint8_t) atoi(value.c_str());
+  }
+  return wz5005::DEFAULT_ADDR;
+}
+
+int renderStatus(char *buff, const dps_status &dps) {
+  PROF_SCOPE(PROF_RENDER);
+  return sprintf(buff, status_fmt,
+                 dps.uset, dps.iset, dps.uout, dps.iout,
+                 dps.temp, dps.uin, dps.lock, dps.protect,
+                 dps.cvcc, dps.onoff, dps.offon,
+                 (unsigned long)dps.stamp, millis() - dps.stamp);
+}
+
+// /status.bin, the same numbers as /status in a fixed 32 byte little
+// endian record. index.html has the matching decodeStatus()
+//   0 version  1 dev  2 uset iset uout iout temp uin lock protect cvcc
+//   onoff offon (u16 each)  24 stamp (u32)  28 age (u32)
+#define STATUS_BIN_VERSION 1
+#define STATUS_BIN_LEN 32
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  p = put16(p, (uint16_t)v);
+  return put16(p, (uint16_t)(v >> 16));
+}
+
+int renderStatusBin(uint8_t *buff, const dps_status &dps, uint8_t dev) {
+  uint8_t *p = buff;
+  *p++ = STATUS_BIN_VERSION;
+  *p++ = dev;
+  p = put16(p, dps.uset);
+  p = put16(p, dps.iset);
+  p = put16(p, dps.uout);
+  p = put16(p, dps.iout);
+  p = put16(p, dps.temp);
+  p = put16(p, dps.uin);
+  p = put16(p, dps.lock);
+  p = put16(p, dps.protect);
+  p = put16(p, dps.cvcc);
+  p = put16(p, dps.onoff);
+  p = put16(p, dps.offon);
+  p = put32(p, dps.stamp);
+  p = put32(p, millis() - dps.stamp);
+  return p - buff;
+}
+
+void handleStatusBin() {
+  PROF_SCOPE(PROF_STATUS_BIN);
+  dps_status dps;
+  uint8_t dev = argDev();
+  if (dps_read_status(&dps, dev)) {
+    reply(200, "application/octet-stream", renderStatusBin((uint8_t *)replyBody, dps, dev));
+  } else {
+    reply(500, "application/octet-stream", 0);
+  }
+}
 
 void handleStatus() {
+  PROF_SCOPE(PROF_STATUS);
   digitalWrite(LED_PIN, LOW);
-  char buff[256];
   dps_status dps;
-  if (dps_read_status(&dps)) {
-    sprintf(buff, status_fmt,
-            dps.uset, dps.iset, dps.uout, dps.iout,
-            dps.temp, dps.uin, dps.lock, dps.protect,
-            dps.cvcc, dps.onoff);
-    String data(buff);
-    server.send(200, "application/json", data);
+  if (dps_read_status(&dps, argDev())) {
+    reply(200, "application/json", renderStatus(replyBody, dps));
   } else {
-    server.send(500, "application/json", "{}");
+    replyEmpty(500);
   }
 }
 
 void handleVoltage() {
+  PROF_SCOPE(PROF_SET);
   digitalWrite(LED_PIN, LOW);
-  String value = server.arg("v");
+  const String &value = server.arg("v");
   if (value.length() > 0) {
     int ival = atoi(value.c_str());
     if (ival >= MIN_VOLTAGE && ival < MAX_VOLTAGE) {
-      dps_set_voltage((uint16_t) ival);
-      server.send(200, "application/json", "{}");
+      replyEmpty(dps_set_voltage((uint16_t) ival, argDev()) ? 200 : 503); // 503 command queue full
       return;
     }
   }
-  server.send(400, "application/json", "{}");
+  replyEmpty(400);
 }
 
 void handleCurrent() {
+  PROF_SCOPE(PROF_SET);
   digitalWrite(LED_PIN, LOW);
-  String value = server.arg("v");
+  const String &value = server.arg("v");
   if (value.length() > 0) {
     int ival = atoi(value.c_str());
     if (ival >= MIN_CURRENT && ival < MAX_CURRENT) {
-      dps_set_current((uint16_t) ival);
-      server.send(200, "application/json", "{}");
+      replyEmpty(dps_set_current((uint16_t) ival, argDev()) ? 200 : 503); // 503 command queue full
       return;
     }
   }
-  server.send(400, "application/json", "{}");
+  replyEmpty(400);
 }
 
-String oldval = "0";
-String oldval2 = "0";
-
 void handleOnOff() {
-  dps_status *dest;
-
-  String value = server.arg("v");
-  if (value == "1") {
-  doupdateon = 1;
-  doupdateout = 2;
-  } 
-  oldval = value;
-  delay(100);
-  server.send(200, "application/json", "{}");
-  delay(30);
+  PROF_SCOPE(PROF_SET);
+  if (server.arg("v") == "1") {
+    replyEmpty(dps_set_output(true, argDev()) ? 200 : 503); // 503 command queue full
+    return;
+  }
+  replyEmpty(200);
 }
 
 void handleOffOn() {
-  dps_status *dest;
-
+  PROF_SCOPE(PROF_SET);
 //  digitalWrite(LED_PIN, LOW);
-  String value = server.arg("v");
-  if (value == "1") {
-  doupdateon = 0;
-  doupdateout = 2;
-  } 
-  oldval2 = value;
-  delay(100);
-  server.send(200, "application/json", "{}");
-  delay(30);
+  if (server.arg("v") == "1") {
+    replyEmpty(dps_set_output(false, argDev()) ? 200 : 503); // 503 command queue full
+    return;
+  }
+  replyEmpty(200);
+}
+
+
+// /history?since=MS&step=MS, rows of [t,uset,iset,uout,iout,cvcc]
+// oldest first, t in the same millis() as the status stamp. every step
+// ms of samples get averaged into one row, and step is stretched when
+// needed so a reply never has more than HISTORY_MAX_POINTS rows
+#define HISTORY_MAX_POINTS 600
+
+// /history body, d->pos is the time of the next row, d->end the newest
+// sample when the request came in and d->step samples per row. goes by
+// time rather than ring index so samples pushed in while a slow browser
+// reads dont shift it. d->part: 0 nothing sent, 1 the opening, 2 some
+// rows, 3 all of it
+static size_t historyFill(download *d, uint8_t *buf, size_t len) {
+  size_t n = 0;
+  if (d->part == 0) {
+    n = sprintf((char *)buf, "{\"now\":%lu,\"step\":%lu,\"rows\":[",
+                millis(), (unsigned long)d->step * HISTORY_INTERVAL);
+    d->part = 1;
+  }
+  // a row is 35 chars at most
+  while ((int32_t)(d->pos - d->end) <= 0 && n + 48 < len) {
+    int i = history_find(d->pos);
+    history_sample h, last;
+    uint32_t t = 0, uset = 0, iset = 0, uout = 0, iout = 0;
+    int valid = 0;
+    for (int j = i; j < i + (int)d->step && history_get(j, &h) && (int32_t)(h.t - d->end) <= 0; j++) {
+      if (!h.valid) {
+        continue; // supply wasnt answering, leave a gap rather than zeros
+      }
+      if (!valid) {
+        t = h.t;
+      }
+      uset += h.uset;
+      iset += h.iset;
+      uout += h.uout;
+      iout += h.iout;
+      last = h;
+      valid++;
+    }
+    d->pos += d->step * HISTORY_INTERVAL;
+    if (!valid) {
+      continue;
+    }
+    n += sprintf((char *)buf + n, "%s[%lu,%lu,%lu,%lu,%lu,%u]", d->part == 2 ? "," : "",
+                 (unsigned long)t, (unsigned long)(uset / valid), (unsigned long)(iset / valid),
+                 (unsigned long)(uout / valid), (unsigned long)(iout / valid), last.cvcc);
+    d->part = 2;
+  }
+  if ((int32_t)(d->pos - d->end) > 0 && d->part < 3 && n + 2 <= len) {
+    memcpy(buf + n, "]}", 2);
+    n += 2;
+    d->part = 3;
+  }
+  return n;
+}
+
+void handleHistory() {
+  PROF_SCOPE(PROF_HISTORY);
+  uint32_t since = strtoul(server.arg("since").c_str(), NULL, 10);
+  uint32_t step = strtoul(server.arg("step").c_str(), NULL, 10);
+  int count = history_count();
+  int first = history_find(since);
+  int per = step > HISTORY_INTERVAL ? step / HISTORY_INTERVAL : 1;
+  if ((count - first) / per > HISTORY_MAX_POINTS) {
+    per = (count - first + HISTORY_MAX_POINTS - 1) / HISTORY_MAX_POINTS;
+  }
+
+  // the body goes out from loop(), so the headers are written by hand.
+  // after a send() the server would end the chunks as soon as this returns
+  replyHeaders(200, "application/json", -1, NULL);
+  download d = {};
+  history_sample h;
+  d.client = server.client();
+  d.fill = historyFill;
+  d.end = history_get(count - 1, &h) ? h.t : 0;
+  d.pos = history_get(first, &h) ? h.t : d.end + 1;
+  d.step = per;
+  d.chunked = true;
+  download_start(d);
+}
+
+// a log file then, for file 0, the records still in ram. file and ram
+// together only ever grow at the end, so when a page gets flushed while
+// this is going the bytes it was after are now further along the file
+static size_t logFill(download *d, uint8_t *buf, size_t len) {
+  if (len > d->end - d->pos) {
+    len = d->end - d->pos;
+  }
+  int got = d->file ? d->file.read(buf, len) : 0;
+  if (got <= 0) {
+    int pending;
+    const uint8_t *tail = tlog_pending(&pending);
+    uint32_t at = d->pos - (d->file ? d->file.size() : 0);
+    got = at < (uint32_t)pending ? pending - at : 0;
+    if ((size_t)got > len) {
+      got = len;
+    }
+    memcpy(buf, tail + at, got);
+  }
+  d->pos += got;
+  return got;
+}
+
+// /log lists the flash log files, /log?file=N downloads one. the records
+// still waiting in ram for a full page are sent on the end of file 0
+void handleLog() {
+  char name[16];
+  const String &value = server.arg("file");
+  if (value.length() == 0) {
+    char *buff = replyBody;
+    int pending;
+    tlog_pending(&pending);
+    int len = sprintf(buff, "{\"record\":%u,\"pending\":%d,\"files\":[",
+                      (unsigned)sizeof(tlog_record), pending);
+    const char *sep = "";
+    for (int i = 0; i < TLOG_FILES; i++) {
+      tlog_name(name, i);
+      if (!SPIFFS.exists(name)) {
+        continue;
+      }
+      File file = SPIFFS.open(name, "r");
+      len += sprintf(buff + len, "%s{\"file\":%d,\"size\":%u}", sep, i, (unsigned)file.size());
+      file.close();
+      sep = ",";
+    }
+    len += sprintf(buff + len, "]}");
+    reply(200, "application/json", len);
+    return;
+  }
+
+  int n = atoi(value.c_str());
+  if (n < 0 || n >= TLOG_FILES) {
+    replyEmpty(400);
+    return;
+  }
+  tlog_name(name, n);
+  int pending = 0;
+  if (n == 0) {
+    tlog_pending(&pending);
+  }
+  File file = SPIFFS.open(name, "r");
+  if (!file && !pending) {
+    replyEmpty(404);
+    return;
+  }
+  download d = {};
+  d.client = server.client();
+  d.fill = logFill;
+  d.file = file;
+  d.end = (file ? file.size() : 0) + pending;
+  replyHeaders(200, "application/octet-stream", d.end, NULL);
+  download_start(d);
+}
+
+void handleDevices() {
+  char *buff = replyBody;
+  uint8_t addrs[DPS_DEVICES];
+  int n = dps_devices(addrs, DPS_DEVICES);
+  int len = sprintf(buff, "[");
+  for (int i = 0; i < n && len < REPLY_BODY - 48; i++) {
+    const dps_status *dps = dps_snapshot(addrs[i]);
+    len += sprintf(buff + len, "%s{\"dev\":%d,\"onoff\":%d,\"age\":%lu}",
+                   i ? "," : "", addrs[i], dps->onoff, millis() - dps->stamp);
+  }
+  len += sprintf(buff + len, "]");
+  reply(200, "application/json", len);
+}
+
+// renumber a supply, /addr?dev=OLD&v=NEW
+void handleAddress() {
+  const String &value = server.arg("v");
+  int ival = atoi(value.c_str());
+  if (value.length() > 0 && ival > 0 && ival <= 0xFF) {
+    replyEmpty(dps_set_address(argDev(), (uint8_t) ival) ? 200 : 409); // 409 address taken or queue full
+    return;
+  }
+  replyEmpty(400);
+}
+
+// /diag/psu, request to reply latency per command byte as the poller
+// learned it, ms. timeout is what the poller waits for that command now
+void handleDiagPsu() {
+  char *buff = replyBody;         // 10 entries of at most ~95 chars
+  dps_lat lat[10];
+  int n = dps_latency(lat, 10);
+  int len = sprintf(buff, "[");
+  for (int i = 0; i < n; i++) {
+    len += sprintf(buff + len, "%s{\"cmd\":%d,\"replies\":%lu,\"timeouts\":%lu,\"p50\":%u,\"p99\":%u,\"timeout\":%u}",
+                   i ? "," : "", lat[i].cmd, (unsigned long)lat[i].replies, (unsigned long)lat[i].timeouts,
+                   lat[i].p50, lat[i].p99, lat[i].timeout);
+  }
+  len += sprintf(buff + len, "]");
+  reply(200, "application/json", len);
+}
+
+// /diag/link, how clean the serial line to the supplies is. decoder
+// resyncs and checksum failures, replies that never came, and the error
+// codes the supplies sent back in their acks
+void handleDiagLink() {
+  dps_stats st;
+  dps_stats_get(&st);
+  int len = sprintf(replyBody,
+          "{\"frames\":%lu,\"badsum\":%lu,\"resyncs\":%lu,\"skipped\":%lu,\"overflows\":%lu,"
+          "\"timeouts\":%lu,\"acks\":%lu,\"badtxchksm\":%lu,\"badcmndorovrflw\":%lu,"
+          "\"badcmndcntexec\":%lu,\"invalidcmd\":%lu,\"unknowncmd\":%lu,\"othererr\":%lu,"
+          "\"retries\":%lu,\"giveups\":%lu}",
+          (unsigned long)st.frames, (unsigned long)st.badsum, (unsigned long)st.resyncs,
+          (unsigned long)st.skipped, (unsigned long)st.overflows, (unsigned long)st.timeouts,
+          (unsigned long)st.acks, (unsigned long)st.badtxchksm, (unsigned long)st.badcmndorovrflw,
+          (unsigned long)st.badcmndcntexec, (unsigned long)st.invalidcmd, (unsigned long)st.unknowncmd,
+          (unsigned long)st.othererr, (unsigned long)st.retries, (unsigned long)st.giveups);
+  reply(200, "application/json", len);
+}
+
+// /diag/heap, free heap, the biggest block left and fragmentation now and
+// at their worst since boot, then a row of [free,maxblock,frag] per
+// HEAP_INTERVAL, oldest first. goes out from loop() like /history, a
+// week of rows is over 2KB. d->pos is the next row, d->part as there
+static size_t heapFill(download *d, uint8_t *buf, size_t len) {
+  size_t n = 0;
+  if (d->part == 0) {
+    heapstat hs;
+    heapstat_get(&hs);
+    n = sprintf((char *)buf, "{\"free\":%lu,\"maxblock\":%lu,\"frag\":%u,"
+                "\"minfree\":%lu,\"minblock\":%lu,\"maxfrag\":%u,\"interval\":%lu,\"samples\":[",
+                (unsigned long)hs.freeheap, (unsigned long)hs.maxblock, hs.frag,
+                (unsigned long)hs.minfree, (unsigned long)hs.minblock, hs.maxfrag,
+                (unsigned long)HEAP_INTERVAL);
+    d->part = 1;
+  }
+  heapstat_sample s;
+  // a row is 20 chars at most
+  while (n + 24 < len && heapstat_sample_get(d->pos, &s)) {
+    n += sprintf((char *)buf + n, "%s[%u,%u,%u]", d->pos ? "," : "", s.freeheap, s.maxblock, s.frag);
+    d->pos++;
+  }
+  if (!heapstat_sample_get(d->pos, &s) && d->part < 3 && n + 2 <= len) {
+    memcpy(buf + n, "]}", 2);
+    n += 2;
+    d->part = 3;
+  }
+  return n;
+}
+
+// /diag/latency, per region of prof.hpp how many samples, the slowest
+// and p50/p99 in cpu cycles (as the top of the log2 bucket they fall in)
+// and the histogram up to its last non empty bucket. a whole region can
+// be more than fill() gets at once, so it goes in pieces: d->pos is the
+// region, d->part 1 its opening next, 2 bucket d->step next, 3 all done
+static size_t latencyFill(download *d, uint8_t *buf, size_t len) {
+  size_t n = 0;
+  if (d->part == 0) {
+    n = sprintf((char *)buf, "{\"mhz\":%u,\"regions\":[", ESP.getCpuFreqMHz());
+    d->part = 1;
+  }
+  prof_region p;
+  while (d->part < 3) {
+    if (!prof_get(d->pos, &p)) {
+      if (n + 2 > len) {
+        break;
+      }
+      memcpy(buf + n, "]}", 2);
+      n += 2;
+      d->part = 3;
+      break;
+    }
+    int last = PROF_BUCKETS - 1;
+    while (last > 0 && !p.hist[last]) {
+      last--;
+    }
+    if (d->part == 1) {
+      // the opening is 104 chars at most
+      if (n + 112 > len) {
+        break;
+      }
+      n += sprintf((char *)buf + n, "%s{\"name\":\"%s\",\"count\":%lu,\"max\":%lu,\"p50\":%lu,\"p99\":%lu,\"hist\":[",
+                   d->pos ? "," : "", prof_name(d->pos), (unsigned long)p.count, (unsigned long)p.max,
+                   (unsigned long)prof_percentile(&p, 500), (unsigned long)prof_percentile(&p, 990));
+      d->part = 2;
+      d->step = 0;
+    }
+    while ((int)d->step <= last && n + 8 <= len) {
+      n += sprintf((char *)buf + n, d->step ? ",%u" : "%u", p.hist[d->step]);
+      d->step++;
+    }
+    if ((int)d->step <= last || n + 2 > len) {
+      break;
+    }
+    memcpy(buf + n, "]}", 2);
+    n += 2;
+    d->pos++;
+    d->part = 1;
+  }
+  return n;
+}
+
+void handleDiagLatency() {
+  replyHeaders(200, "application/json", -1, NULL);
+  download d = {};
+  d.client = server.client();
+  d.fill = latencyFill;
+  d.chunked = true;
+  download_start(d);
+}
+
+// /metrics for prometheus, see metrics.hpp
+void handleMetrics() {
+  replyHeaders(200, "text/plain; version=0.0.4", -1, NULL);
+  download d = {};
+  d.client = server.client();
+  d.fill = metrics_fill;
+  d.chunked = true;
+  download_start(d);
+}
+
+// /diag/trace?since=N, the poller's trace records from number N on (or
+// the oldest still kept) as raw trace_recs after 8 bytes of first and
+// next, both little endian uint32. ask again with since=next for what
+// came after. a record overwritten before the download got to it goes
+// out with id 0. d->pos is the next record number, d->end where it stops
+static size_t traceFill(download *d, uint8_t *buf, size_t len) {
+  size_t n = 0;
+  if (d->part == 0) {
+    memcpy(buf, &d->pos, 4);
+    memcpy(buf + 4, &d->end, 4);
+    n = 8;
+    d->part = 1;
+  }
+  while (d->pos != d->end && n + sizeof(trace_rec) <= len) {
+    trace_rec r;
+    if (!trace_get(d->pos, &r)) {
+      memset(&r, 0, sizeof(r));
+      r.seq = (uint16_t)d->pos;
+    }
+    memcpy(buf + n, &r, sizeof(r));
+    n += sizeof(r);
+    d->pos++;
+  }
+  return n;
+}
+
+void handleDiagTrace() {
+  uint32_t since = strtoul(server.arg("since").c_str(), NULL, 10);
+  download d = {};
+  d.client = server.client();
+  d.fill = traceFill;
+  d.pos = since > trace_first() ? since : trace_first();
+  d.end = trace_next();
+  if (d.pos > d.end) {
+    d.pos = d.end;
+  }
+  replyHeaders(200, "application/octet-stream", 8 + (d.end - d.pos) * sizeof(trace_rec), NULL);
+  download_start(d);
+}
+
+void handleDiagHeap() {
+  replyHeaders(200, "application/json", -1, NULL);
+  download d = {};
+  d.client = server.client();
+  d.fill = heapFill;
+  d.chunked = true;
+  download_start(d);
+}
+
+// server sent events on /events?dev=N (or raw records on /stream.bin).
+// the connection is kept after the handler returns and pushEvents() writes
+// a status line down it each time the poller folds in a new reply, so the
+// page doesnt have to ask. an event only goes to a listener whose send
+// buffer has room for all of it, write() would otherwise sit in loop()
+// waiting on acks from a slow one and hold up the poller. the event is
+// skipped for that listener instead, the next one has everything anyway
+#define SSE_CLIENTS 4
+#define SSE_MISSED 20           // events in a row skipped before a listener is dropped
+
+struct sseClient {
+  WiFiClient client;
+  uint8_t dev;
+  bool bin;             // /stream.bin, raw 32 byte records back to back
+  uint32_t stamp;
+  uint8_t missed;       // events skipped for want of room since the last one sent
+};
+
+sseClient sseClients[SSE_CLIENTS];
+
+static void subscribe(bool bin) {
+  int slot = -1;
+  for (int i = 0; i < SSE_CLIENTS; i++) {
+    if (!sseClients[i].client.connected()) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    int len = sprintf(replyBody, "too many listeners");
+    reply(503, "text/plain", len);
+    return;
+  }
+  WiFiClient client = server.client();
+  client.setNoDelay(true);
+  sseClients[slot].client = client;
+  sseClients[slot].dev = argDev();
+  sseClients[slot].bin = bin;
+  sseClients[slot].stamp = 0;
+  sseClients[slot].missed = 0;
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  if (bin) {
+    server.sendContent("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: application/octet-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Connection: close\r\n\r\n");
+  } else {
+    server.sendContent("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Connection: keep-alive\r\n\r\n"
+                       "retry: 2000\n\n");
+  }
+}
+
+void handleEvents() {
+  subscribe(false);
 }
 
+void handleStreamBin() {
+  subscribe(true);
+}
 
-String getContentType(String filename) {
-  if (filename.endsWith(".html")) return "text/html";
-  else if (filename.endsWith(".css")) return "text/css";
-  else if (filename.endsWith(".js")) return "application/javascript";
-  else return "text/plain";
+void pushEvents() {
+  char buff[256 + 8];
+  for (int i = 0; i < SSE_CLIENTS; i++) {
+    sseClient *sse = &sseClients[i];
+    if (!sse->client.connected()) {
+      continue;
+    }
+    const dps_status *dps = dps_snapshot(sse->dev);
+    if (!dps || dps->stamp == 0 || dps->stamp == sse->stamp) {
+      continue;
+    }
+    sse->stamp = dps->stamp;
+    int len;
+    if (sse->bin) {
+      len = renderStatusBin((uint8_t *)buff, *dps, sse->dev);
+    } else {
+      len = sprintf(buff, "data: ");
+      len += renderStatus(buff + len, *dps);
+      len += sprintf(buff + len, "\n\n");
+    }
+    if (sse->client.availableForWrite() < (size_t)len) {
+      if (++sse->missed >= SSE_MISSED) {
+        sse->client = WiFiClient(); // stalled, let it reconnect. stop() would wait for the acks
+      }
+      continue;
+    }
+    sse->missed = 0;
+    if (sse->client.write((const uint8_t *)buff, len) != (size_t)len) {
+      sse->client = WiFiClient(); // gone
+    }
+  }
 }
 
+// static files, found in the index assets_scan() built so no flash is
+// touched before the file itself is opened. name.gz goes out instead of
+// name when the browser takes gzip (gzip-data.sh makes them). a browser
+// that already has this version gets a 304 and nothing is read at all,
+// everyone else gets the body from loop() thru downloads_tick()
 void handleFiles() {
+  PROF_SCOPE(PROF_FILES);
   digitalWrite(LED_PIN, LOW);
-  String path = server.uri();
-  if (path.endsWith("/")) path += "index.html";
-  String contentType = getContentType(path);
-  if (SPIFFS.exists(path)) {
-    if (path != "/index.html") {
-      server.sendHeader("Cache-Control", "public, max-age=31536000, immutable");
-      server.sendHeader("Last-Modified", "Mon, 30 Oct 2017 01:11:56 GMT");
-      server.sendHeader("Expires", "06 Aug 2026 12:30:45 GMT");
-    }
-    File file = SPIFFS.open(path, "r");
-    size_t sent = server.streamFile(file, contentType);
-    if (sent) {
-      ;
-    }
-    file.close();
-  } else {
-    server.send(404, "text/html", "not found " + path);
+  const asset *a = assets_find(server.uri().c_str());
+  bool gz = a && a->gzsize && server.header(hdrAcceptEncoding).indexOf("gzip") >= 0;
+  if (!a || (!gz && !a->plain)) {
+    int len = snprintf(replyBody, REPLY_BODY, "not found %s", server.uri().c_str());
+    reply(404, "text/html", len < REPLY_BODY ? len : REPLY_BODY - 1);
+    return;
   }
+  const char *etag = gz ? a->gzetag : a->etag;
+  // index.html changes with /deploy so it is checked every time, the
+  // libraries only change when the data is flashed again
+  char extra[160];
+  snprintf(extra, sizeof(extra), "Cache-Control: %s\r\nETag: %s\r\nVary: Accept-Encoding\r\n%s",
+           strcmp(a->path, "/index.html") ? "public, max-age=31536000" : "no-cache", etag,
+           gz ? "Content-Encoding: gzip\r\n" : "");
+  if (server.header(hdrIfNoneMatch) == etag) {
+    replyHeaders(304, a->type, 0, extra);
+    return;
+  }
+  char name[ASSET_PATH_LEN + 3];
+  snprintf(name, sizeof(name), gz ? "%s.gz" : "%s", a->path);
+  download d = {};
+  d.client = server.client();
+  d.fill = download_file;
+  d.file = SPIFFS.open(name, "r");
+  replyHeaders(200, a->type, d.file.size(), extra);
+  download_start(d);
 }
 
 void handleDeploy() {
   HTTPUpload& upload = server.upload();
   if (upload.status == UPLOAD_FILE_START) {
+    SPIFFS.remove("/index.html.gz"); // would be sent instead of the new one
     fsUploadFile = SPIFFS.open("/index.html", "w");
   } else if (upload.status == UPLOAD_FILE_WRITE) {
     if (fsUploadFile)
@@ -157,12 +737,15 @@ void handleDeploy() {
   } else if (upload.status == UPLOAD_FILE_END) {
     if (fsUploadFile)
       fsUploadFile.close();
+    assets_scan();                // new size and etag for index.html
   }
 }
 
 void setup(void) {
   Serial.begin(9600);
   Serial1.begin(9600);
+  uart_rx_begin();                // PSU replies now come in thru our own isr
+  TRACE_INFO(TR_BOOT);
   //  Serial.swap();
   delay(500);
   
@@ -170,6 +753,8 @@ void setup(void) {
   pinMode(LED_PIN, OUTPUT);     // Initialize the LED_BUILTIN pin as an output
 
   SPIFFS.begin();
+  assets_scan();
+  tlog_begin();
   WiFi.begin(ssid, password);     //Connect to your WiFi router
   Serial.println("Connecting to wifi...");
 
@@ -191,16 +776,33 @@ void setup(void) {
   Serial.println(WiFi.localIP());  //IP address assigned to your ESP
 
   server.on("/status", handleStatus);
+  server.on("/status.bin", handleStatusBin);
+  server.on("/stream.bin", handleStreamBin);
   server.on("/uset", handleVoltage);
   server.on("/iset", handleCurrent);
   server.on("/onoff", handleOnOff);
   server.on("/offon", handleOffOn);
+  server.on("/devices", handleDevices);
+  server.on("/history", handleHistory);
+  server.on("/log", handleLog);
+  server.on("/addr", handleAddress);
+  server.on("/events", handleEvents);
+  server.on("/diag/psu", handleDiagPsu);
+  server.on("/diag/link", handleDiagLink);
+  server.on("/diag/heap", handleDiagHeap);
+  server.on("/diag/trace", handleDiagTrace);
+  server.on("/diag/latency", handleDiagLatency);
+  server.on("/metrics", handleMetrics);
   server.on("/deploy", HTTP_POST, []() {
     server.send(200, "text/plain", "");
   }, handleDeploy);
   server.onNotFound(handleFiles);
+  static const char *headers[] = { "If-None-Match", "Accept-Encoding" };
+  server.collectHeaders(headers, 2);  // handleFiles() needs these, the rest are dropped
 
   server.begin();                  //Start server
+  modbus_begin();
+  bridge_begin();
   Serial.println("HTTP server started");
 
   if (!MDNS.begin(MDSN_NAME)) {
@@ -209,30 +811,24 @@ void setup(void) {
   Serial.println("mDNS responder started");
   // Add service to MDNS-SD
   MDNS.addService("http", "tcp", 80);
-  delay(120);
-  delay(200);
-  Serial1.write(setupstart, 20);
-  delay(100);
-  Serial1.write(setupstart, 20);  
-  delay(100);
-  Serial1.write(setseven, 20);
-  delay(100); 
-  Serial1.write(setseven, 20);
-  delay(100);
-  Serial1.write(recstart, 20);
-  delay(100);
-
-if (Serial.available()) {
-  for (int i = 0; i <= 19; i++) {
-  recvd[i] = Serial.read();
-  }
-  delay(10);
-  }
-  doupdateon = 0;
-  doupdateout = 2;
+  // remote mode, 7V, output off. these go thru the poller's queue, each
+  // one waits for the ack (or its learned timeout) before the next goes
+  dps_set_mode(true);
+  dps_set_voltage_current(700, 4);
+  dps_set_output(false);
 }
 
 void loop(void) {
+  PROF_SCOPE(PROF_LOOP);
+  dps_tick();                     //Decode PSU replies, send the next query
+  history_tick();                 //Sample into the /history ring
+  tlog_hold(downloads_using(logFill) > 0); //No rotating files out from under a /log download
+  tlog_tick();                    //Energy and the flash log
   server.handleClient();          //Handle client requests
+  downloads_tick();               //Feed files and /history to slow browsers
+  heapstat_tick();                //Free heap and fragmentation for /diag/heap
+  pushEvents();                   //Stream new samples to /events listeners
+  modbus_tick();                  //Modbus-tcp masters, reads from the snapshot
+  bridge_tick();                  //Raw frames to and from the tcp bridge
   digitalWrite(LED_PIN, HIGH);
 }
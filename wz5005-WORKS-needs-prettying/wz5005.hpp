@@ -0,0 +1,258 @@
+#ifndef __WZ5005__
+#define __WZ5005__
+
+// wz5005 serial protocol, header only so the same code builds in the
+// sketch and on linux (wz5005-host). Nothing in here touches the heap,
+// everything encodes into / decodes from a caller owned 20 byte Buffer.
+//
+// frame: AA addr cmd arg[16] sum, sum = low byte of the other 19 added up
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+namespace wz5005 {
+
+constexpr size_t FRAME_LEN = 20;
+constexpr size_t ARGS_LEN = 16;
+constexpr uint8_t HEADER = 0xAA;
+constexpr uint8_t DEFAULT_ADDR = 0x01;
+
+typedef std::array<uint8_t, FRAME_LEN> Buffer;
+
+enum Command : uint8_t {
+  ACK           = 0x12,   // reply to set commands, arg is one of the codes in dps.hpp
+  SET_MODE      = 0x20,   // 0 manual, 1 remote
+  SET_ADDRESS   = 0x21,
+  SET_OUTPUT    = 0x22,   // 0 off, 1 on
+  GET_STATUS    = 0x23,
+  GET_INFO      = 0x24,
+  GET_OUTPUT    = 0x29,
+  GET_STATS     = 0x2A,
+  GET_SETPOINTS = 0x2B,
+  SET_SETPOINTS = 0x2C,
+};
+
+enum class Error : uint8_t {
+  OK,
+  BAD_HEADER,
+  BAD_CHECKSUM,
+  WRONG_COMMAND,      // good frame, but not the one the caller asked for
+};
+
+constexpr uint8_t checksum(const uint8_t *p, size_t n = FRAME_LEN - 1) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum = (uint8_t)(sum + p[i]);
+  }
+  return sum;
+}
+
+constexpr bool valid(const Buffer &b) {
+  return b[0] == HEADER && checksum(b.data()) == b[FRAME_LEN - 1];
+}
+
+// a request with one argument byte, which is all most of them need. this
+// is constexpr so fixed queries cost no ram init and no cycles at runtime
+constexpr Buffer frame(uint8_t cmd, uint8_t arg = 0, uint8_t addr = DEFAULT_ADDR) {
+  Buffer b{};
+  b[0] = HEADER;
+  b[1] = addr;
+  b[2] = cmd;
+  b[3] = arg;
+  b[FRAME_LEN - 1] = checksum(b.data());
+  return b;
+}
+
+struct Frame {
+  uint8_t addr;
+  uint8_t cmd;
+  uint8_t args[ARGS_LEN];
+
+  // argument offsets are 0 based from the first byte after cmd
+  uint16_t u16(size_t i) const {
+    return (uint16_t)((args[i] << 8) | args[i + 1]);
+  }
+  void set_u16(size_t i, uint16_t v) {
+    args[i] = (uint8_t)(v >> 8);
+    args[i + 1] = (uint8_t)v;
+  }
+
+  void encode(Buffer &out) const {
+    out[0] = HEADER;
+    out[1] = addr;
+    out[2] = cmd;
+    for (size_t i = 0; i < ARGS_LEN; i++) {
+      out[3 + i] = args[i];
+    }
+    out[FRAME_LEN - 1] = checksum(out.data());
+  }
+
+  static Error decode(const Buffer &in, Frame &out) {
+    if (in[0] != HEADER) {
+      return Error::BAD_HEADER;
+    }
+    if (checksum(in.data()) != in[FRAME_LEN - 1]) {
+      return Error::BAD_CHECKSUM;
+    }
+    out.addr = in[1];
+    out.cmd = in[2];
+    for (size_t i = 0; i < ARGS_LEN; i++) {
+      out.args[i] = in[3 + i];
+    }
+    return Error::OK;
+  }
+};
+
+// typed messages. each one knows its command byte and how to move itself
+// in and out of a Frame, encode()/decode() below do the rest
+
+// what the supply sends back for commands that dont return data, 0x80
+// when all is well or BADTXCHKSM and friends (dps.hpp) when it isnt
+struct Ack {
+  static constexpr uint8_t CMD = ACK;
+  uint8_t code;
+  void to(Frame &f) const { f.args[0] = code; }
+  void from(const Frame &f) { code = f.args[0]; }
+};
+
+struct SetMode {
+  static constexpr uint8_t CMD = SET_MODE;
+  bool remote;
+  void to(Frame &f) const { f.args[0] = remote ? 1 : 0; }
+  void from(const Frame &f) { remote = f.args[0] != 0; }
+};
+
+struct SetAddress {
+  static constexpr uint8_t CMD = SET_ADDRESS;
+  uint8_t new_addr;
+  void to(Frame &f) const { f.args[0] = new_addr; }
+  void from(const Frame &f) { new_addr = f.args[0]; }
+};
+
+struct SetOutput {
+  static constexpr uint8_t CMD = SET_OUTPUT;
+  bool on;
+  void to(Frame &f) const { f.args[0] = on ? 1 : 0; }
+  void from(const Frame &f) { on = f.args[0] != 0; }
+};
+
+// 0x23, request args are zero (the firmware has always sent a 1, the
+// supply doesnt care), reply is output / cc-cv / abnormal state
+struct Status {
+  static constexpr uint8_t CMD = GET_STATUS;
+  bool on;
+  bool cc;
+  uint8_t abnormal;     // 0 none, 1 over voltage, 2 over current
+  void to(Frame &f) const {
+    f.args[0] = on ? 1 : 0;
+    f.args[1] = cc ? 1 : 0;
+    f.args[2] = abnormal;
+  }
+  void from(const Frame &f) {
+    on = f.args[0] != 0;
+    cc = f.args[1] != 0;
+    abnormal = f.args[2];
+  }
+};
+
+struct Info {
+  static constexpr uint8_t CMD = GET_INFO;
+  uint8_t model;
+  uint16_t version;
+  uint32_t item_id;
+  void to(Frame &f) const {
+    f.args[0] = model;
+    f.set_u16(1, version);
+    f.set_u16(3, (uint16_t)(item_id >> 16));
+    f.set_u16(5, (uint16_t)item_id);
+  }
+  void from(const Frame &f) {
+    model = f.args[0];
+    version = f.u16(1);
+    item_id = ((uint32_t)f.u16(3) << 16) | f.u16(5);
+  }
+};
+
+// 0x29, volts*100 and amps*1000 like the set points
+struct Output {
+  static constexpr uint8_t CMD = GET_OUTPUT;
+  uint16_t uout;
+  uint16_t iout;
+  void to(Frame &f) const {
+    f.set_u16(0, uout);
+    f.set_u16(2, iout);
+  }
+  void from(const Frame &f) {
+    uout = f.u16(0);
+    iout = f.u16(2);
+  }
+};
+
+// 0x2A, layout not worked out yet so it is carried raw
+struct Stats {
+  static constexpr uint8_t CMD = GET_STATS;
+  uint8_t raw[ARGS_LEN];
+  void to(Frame &f) const {
+    for (size_t i = 0; i < ARGS_LEN; i++) f.args[i] = raw[i];
+  }
+  void from(const Frame &f) {
+    for (size_t i = 0; i < ARGS_LEN; i++) raw[i] = f.args[i];
+  }
+};
+
+// 0x2B reply and 0x2C request share this layout. the tail holds lvp and
+// friends which we dont decode but must hand back untouched on a set
+template <uint8_t C>
+struct SetpointsT {
+  static constexpr uint8_t CMD = C;
+  uint16_t ovp;
+  uint16_t ocp;
+  uint16_t uset;
+  uint16_t iset;
+  uint8_t tail[8];
+  void to(Frame &f) const {
+    f.set_u16(0, ovp);
+    f.set_u16(2, ocp);
+    f.set_u16(4, uset);
+    f.set_u16(6, iset);
+    for (size_t i = 0; i < 8; i++) f.args[8 + i] = tail[i];
+  }
+  void from(const Frame &f) {
+    ovp = f.u16(0);
+    ocp = f.u16(2);
+    uset = f.u16(4);
+    iset = f.u16(6);
+    for (size_t i = 0; i < 8; i++) tail[i] = f.args[8 + i];
+  }
+};
+
+typedef SetpointsT<GET_SETPOINTS> Setpoints;
+typedef SetpointsT<SET_SETPOINTS> SetSetpoints;
+
+template <typename T>
+void encode(const T &msg, Buffer &out, uint8_t addr = DEFAULT_ADDR) {
+  Frame f = {};
+  f.addr = addr;
+  f.cmd = T::CMD;
+  msg.to(f);
+  f.encode(out);
+}
+
+template <typename T>
+Error decode(const Buffer &in, T &msg) {
+  Frame f;
+  Error err = Frame::decode(in, f);
+  if (err != Error::OK) {
+    return err;
+  }
+  if (f.cmd != T::CMD) {
+    return Error::WRONG_COMMAND;
+  }
+  msg.from(f);
+  return Error::OK;
+}
+
+} // namespace wz5005
+
+#endif
@@ -0,0 +1,95 @@
+// wz5005-bench - decode throughput of the frame codec, plus a random
+// round trip pass so a broken encode/decode shows up as a failure
+// instead of as a fast number
+//
+//   ./wz5005-bench [frames] [seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "wz5005.hpp"
+
+using namespace wz5005;
+
+static const uint8_t commands[] = {
+  SET_MODE, SET_ADDRESS, SET_OUTPUT, GET_STATUS, GET_INFO,
+  GET_OUTPUT, GET_STATS, GET_SETPOINTS, SET_SETPOINTS,
+};
+
+static int roundtrip(std::mt19937 &rng, size_t n) {
+  int bad = 0;
+  for (size_t i = 0; i < n; i++) {
+    Frame in = {};
+    in.addr = (uint8_t)rng();
+    in.cmd = commands[rng() % sizeof(commands)];
+    for (size_t j = 0; j < ARGS_LEN; j++) in.args[j] = (uint8_t)rng();
+
+    Buffer buf;
+    Frame out;
+    in.encode(buf);
+    if (Frame::decode(buf, out) != Error::OK || memcmp(&in, &out, sizeof(in)) != 0) {
+      bad++;
+      continue;
+    }
+
+    // typed path, set points carry every arg byte so must match exactly
+    if (in.cmd == SET_SETPOINTS) {
+      SetSetpoints sp;
+      Buffer again;
+      if (decode(buf, sp) != Error::OK) { bad++; continue; }
+      encode(sp, again, in.addr);
+      if (again != buf) bad++;
+    }
+
+    // flip one byte, anything but a header hit must fail the checksum
+    size_t pos = rng() % FRAME_LEN;
+    uint8_t flip = (uint8_t)(1 + rng() % 255);
+    buf[pos] ^= flip;
+    Error err = Frame::decode(buf, out);
+    if (pos == 0 ? err != Error::BAD_HEADER : err != Error::BAD_CHECKSUM) bad++;
+  }
+
+  // known frames from the sketch and bens_scripts
+  if (frame(GET_SETPOINTS)[19] != 0xD6) bad++;
+  if (frame(SET_OUTPUT, 1)[19] != 0xCE) bad++;
+  if (frame(SET_MODE, 1)[19] != 0xCC) bad++;
+  Buffer seven;
+  encode(SetSetpoints{ 0x1388, 0x12AB, 700, 4, {0, 0, 0, 0x42, 0, 0, 0, 0} }, seven);
+  if (seven[19] != 0x33) bad++;
+  return bad;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+  unsigned seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 5005;
+  std::mt19937 rng(seed);
+
+  int bad = roundtrip(rng, n / 10 + 1);
+  printf("roundtrip: %zu frames, %d bad\n", n / 10 + 1, bad);
+
+  std::vector<Buffer> frames(4096);
+  for (Buffer &b : frames) {
+    Frame f = {};
+    f.addr = DEFAULT_ADDR;
+    f.cmd = commands[rng() % sizeof(commands)];
+    for (size_t j = 0; j < ARGS_LEN; j++) f.args[j] = (uint8_t)rng();
+    f.encode(b);
+  }
+
+  unsigned sink = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    Frame f;
+    if (Frame::decode(frames[i & (frames.size() - 1)], f) == Error::OK) {
+      sink += f.cmd + f.args[i & (ARGS_LEN - 1)];
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(t1 - t0).count();
+  printf("decode: %zu frames in %.3f s, %.1f Mframes/s, %.1f ns/frame (%u)\n",
+         n, secs, n / secs / 1e6, secs * 1e9 / n, sink & 1);
+  return bad ? 1 : 0;
+}
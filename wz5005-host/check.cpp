@@ -0,0 +1,330 @@
+// wz5005-check - pass/fail checks for the sketch code that has an answer
+// known ahead, as opposed to the timing and load runs in the other
+// tools. exits 1 if anything is off, `make check` runs it
+//
+//   ./wz5005-check [-s seed] [-v]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+#include "Arduino.h"
+#include "shim.hpp"
+#include "psu.hpp"
+#include "wz5005.hpp"
+#include "dps.hpp"
+#include "prof.hpp"
+
+using namespace wz5005;
+
+static bool verbose = false;
+static int checks = 0, failed = 0;
+
+static void check(bool ok, const char *what) {
+  checks++;
+  if (!ok) {
+    failed++;
+    printf("FAIL %s\n", what);
+  } else if (verbose) {
+    printf("ok   %s\n", what);
+  }
+}
+
+// feed bytes, how many frames came out. the frames go in got
+static int feed(dps_rx *rx, const uint8_t *p, size_t n, std::vector<Buffer> *got = NULL) {
+  int frames = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (dps_rx_feed(rx, p[i])) {
+      frames++;
+      if (got) got->push_back(rx->frame);
+    }
+  }
+  return frames;
+}
+
+static int feed(dps_rx *rx, const Buffer &b, std::vector<Buffer> *got = NULL) {
+  return feed(rx, b.data(), b.size(), got);
+}
+
+static bool counters(const dps_rx *rx, uint32_t frames, uint32_t badsum, uint32_t resyncs, uint32_t skipped) {
+  if (verbose) {
+    printf("     frames %u badsum %u resyncs %u skipped %u\n", rx->frames, rx->badsum, rx->resyncs, rx->skipped);
+  }
+  return rx->frames == frames && rx->badsum == badsum && rx->resyncs == resyncs && rx->skipped == skipped;
+}
+
+// dps_rx_feed with the stream cut up, garbled and missing bytes
+static void rx_checks(std::mt19937 &rng) {
+  // no 0xAA anywhere past the header in these two
+  Buffer a = frame(GET_STATUS, 0x01);
+  Buffer b;
+  encode(Output{ 1234, 567 }, b);
+
+  dps_rx rx = {};
+  check(feed(&rx, a.data(), 7) == 0 && rx.pos == 7, "rx: no frame from the first 7 bytes");
+  check(feed(&rx, a.data() + 7, 13) == 1 && rx.frame == a && rx.pos == 0, "rx: frame split 7/13");
+  check(counters(&rx, 1, 0, 0, 0), "rx: split frame counters");
+
+  rx = {};
+  const uint8_t junk[] = { 0x00, 0x55, 0x13, 0xFF };
+  feed(&rx, junk, sizeof(junk));
+  check(feed(&rx, a) == 1 && counters(&rx, 1, 0, 0, 4), "rx: junk before the header is skipped");
+
+  // bad checksum, no header further in, the whole window goes
+  rx = {};
+  Buffer bad = a;
+  bad[19] ^= 0x40;
+  check(feed(&rx, bad) == 0, "rx: bad checksum isnt a frame");
+  check(feed(&rx, b) == 1 && rx.frame == b, "rx: next frame after a bad checksum");
+  check(counters(&rx, 1, 1, 0, 20), "rx: bad checksum counters");
+
+  // a garbled arg byte the same
+  rx = {};
+  bad = b;
+  bad[5] ^= 0x01;
+  check(feed(&rx, bad) == 0 && feed(&rx, a) == 1, "rx: garbled arg byte then a good frame");
+  check(counters(&rx, 1, 1, 0, 20), "rx: garbled arg counters");
+
+  // the last 10 bytes of a lost, b starts part way into the window. the
+  // window slides to b's header and b still comes out whole
+  rx = {};
+  std::vector<Buffer> got;
+  feed(&rx, a.data(), 10);
+  check(feed(&rx, b, &got) == 1 && got.size() == 1 && got[0] == b, "rx: header mid window, frame recovered");
+  check(counters(&rx, 1, 1, 1, 10), "rx: header mid window counters");
+
+  // 0xAA in the args of a good frame is data, not a resync
+  rx = {};
+  Buffer aa;
+  encode(Setpoints{ 0xAAAA, 0x00AA, 500, 4, { 0xAA, 0, 0, 0, 0, 0, 0, 0 } }, aa);
+  check(feed(&rx, aa) == 1 && rx.frame == aa && counters(&rx, 1, 0, 0, 0), "rx: 0xAA in the args");
+
+  // same thing cut short, then a frame. the 0xAA args are tried as
+  // headers first, none add up, the real one does
+  rx = {};
+  got.clear();
+  feed(&rx, aa.data(), 12);
+  check(feed(&rx, a, &got) == 1 && got[0] == a && rx.badsum >= 1 && rx.resyncs >= 1,
+        "rx: 0xAA args in a cut frame dont hide the next one");
+
+  // random stream: frames with random args, 1 in 4 of them 0xAA, some
+  // bytes dropped, some flipped. what comes out should be the frames that
+  // went in whole, in order. the odd window that starts on an 0xAA arg
+  // adds up by chance (1 in 256 with an 8 bit sum) and gets thru, that
+  // is the protocol and not the receiver, it only has to stay rare
+  rx = {};
+  int sent = 0, intact = 0, out = 0, wrong = 0;
+  Buffer prev = {};
+  for (int i = 0; i < 20000; i++) {
+    Frame f = {};
+    f.addr = DEFAULT_ADDR;
+    f.cmd = GET_OUTPUT;
+    for (size_t j = 0; j < ARGS_LEN; j++) f.args[j] = rng() % 4 ? (uint8_t)rng() : HEADER;
+    Buffer buf;
+    f.encode(buf);
+    std::vector<uint8_t> wire(buf.begin(), buf.end());
+    bool whole = true;
+    if (rng() % 50 == 0) {
+      wire.erase(wire.begin() + rng() % wire.size());
+      whole = false;
+    } else if (rng() % 50 == 0) {
+      wire[rng() % wire.size()] ^= 1 + rng() % 255;
+      whole = false;
+    }
+    sent++;
+    intact += whole;
+    got.clear();
+    out += feed(&rx, wire.data(), wire.size(), &got);
+    for (const Buffer &g : got) {
+      // a frame cut short can come out of the next one's bytes
+      wrong += g != buf && g != prev;
+    }
+    prev = buf;
+  }
+  if (verbose) {
+    printf("     %d sent, %d intact, %d out, %d made up\n", sent, intact, out, wrong);
+  }
+  check(out - wrong <= intact && out - wrong >= intact * 99 / 100, "rx: random stream, intact frames come out");
+  check(wrong <= sent / 1000, "rx: random stream, hardly anything made up");
+  check(rx.frames == (uint32_t)out, "rx: random stream, frames counter");
+}
+
+// the frames the sketch had hand written before the codec, as they
+// were in dps.cpp and the .ino
+static const uint8_t recstart[20] = {0xAA,0x01,0x2B,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD6};
+static const uint8_t readon[20] = {0xAA,0x01,0x23,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD1};
+static const uint8_t offoff2[20] = {0xAA,0x01,0x22,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCD};
+static const uint8_t onon2[20] = {0xAA,0x01,0x22,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCE};
+static const uint8_t temp[20] = {0xAA,0x01,0x2A,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xD6};
+static const uint8_t onoffcccvget[20] = {0xAA,0x01,0x23,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCF};
+static const uint8_t setseven[20] = {0xAA,0x01,0x2C,0x13,0x88,0x12,0xAB,0x02,0xBC,0x00,0x04,0x00,0x00,0x00,0x42,0x00,0x00,0x00,0x00,0x33};
+static const uint8_t setupstart[20] = {0xAA,0x01,0x20,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCC};
+static const uint8_t disableremote[20] = {0xAA,0x01,0x20,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xCC};
+
+// the old set path, poop[] patched in place and summed again each time
+static uint8_t poop[20] = {0xAA,0x01,0x2C,0x13,0x88,0x12,0xAB,0x01,0xF4,0x00,0x04,0x00,0x00,0x00,0x42,0x00,0x00,0x00,0x00,0x6A};
+
+static uint8_t sumsum(void) {
+  uint8_t result = 0;
+  for (int i = 0; i <= 18; i++) {
+    result = (result + poop[i]);
+  }
+  return result;
+}
+
+static void old_set_voltage(uint16_t voltage) {
+  poop[7] = ((uint8_t)(voltage >> 8));
+  poop[8] = ((uint8_t)voltage);
+  poop[19] = sumsum();
+}
+
+static void old_set_current(uint16_t current) {
+  poop[9] = ((uint8_t)(current >> 8));
+  poop[10] = ((uint8_t)current);
+  poop[19] = sumsum();
+}
+
+static bool same(const Buffer &b, const uint8_t *old, size_t n = FRAME_LEN) {
+  return memcmp(b.data(), old, n) == 0;
+}
+
+static struct psu psu;
+static std::vector<Buffer> wire;
+
+static void to_psu(void *, const uint8_t *p, size_t n) {
+  for (size_t i = 0; i + FRAME_LEN <= n; i += FRAME_LEN) {
+    Buffer b;
+    memcpy(b.data(), p + i, FRAME_LEN);
+    wire.push_back(b);
+  }
+  for (size_t i = 0; i < n; i++) psu_feed(&psu, p[i]);
+}
+
+static void from_psu(void *, const uint8_t *p, size_t n) {
+  Serial.rx.insert(Serial.rx.end(), p, p + n);
+}
+
+// the first frame with cmd the sketch's poller puts on the uart within
+// ms, with psu.cpp answering. all zeros when there wasnt one
+static Buffer sketch_sends(uint8_t cmd, uint32_t ms = 2000) {
+  wire.clear();
+  for (uint32_t i = 0; i < ms; i++) {
+    dps_tick();
+    shim_advance(1000);
+    for (const Buffer &b : wire) {
+      if (b[2] == cmd) return b;
+    }
+  }
+  return Buffer{};
+}
+
+// the codec against the old hand written frames byte for byte, first on
+// its own and then what the sketch really sends for each of them.
+// readon and disableremote never added up, their last byte was typed in
+// wrong (D1 for CE, CC for CB), so only the first 19 bytes of those
+static void codec_checks(std::mt19937 &rng) {
+  Buffer b;
+  check(same(frame(GET_SETPOINTS, 0), recstart), "codec: 0x2B recstart");
+  check(same(frame(GET_STATS, 1), temp), "codec: 0x2A temp");
+  check(same(frame(GET_STATUS, 1), onoffcccvget), "codec: 0x23 onoffcccvget");
+  check(same(frame(GET_STATUS, 0), readon, FRAME_LEN - 1) && valid(frame(GET_STATUS, 0)),
+        "codec: 0x23 readon, old sum was wrong");
+  encode(SetOutput{ false }, b);
+  check(same(b, offoff2), "codec: 0x22 offoff2");
+  encode(SetOutput{ true }, b);
+  check(same(b, onon2), "codec: 0x22 onon2");
+  encode(SetMode{ true }, b);
+  check(same(b, setupstart), "codec: 0x20 setupstart");
+  encode(SetMode{ false }, b);
+  check(same(b, disableremote, FRAME_LEN - 1) && valid(b), "codec: 0x20 disableremote, old sum was wrong");
+  encode(SetSetpoints{ 0x1388, 0x12AB, 700, 4, { 0x00, 0x00, 0x00, 0x42, 0x00, 0x00, 0x00, 0x00 } }, b);
+  check(same(b, setseven), "codec: 0x2C setseven");
+
+  // the sketch talking to a pretend supply
+  psu_init(&psu, from_psu, NULL);
+  Serial1.tx = to_psu;
+  check(same(sketch_sends(GET_STATUS), onoffcccvget), "sketch: 0x23 poll");
+  check(same(sketch_sends(GET_SETPOINTS), recstart), "sketch: 0x2B poll");
+  dps_set_mode(true);
+  check(same(sketch_sends(SET_MODE), setupstart), "sketch: 0x20 remote");
+  dps_set_output(true);
+  check(same(sketch_sends(SET_OUTPUT), onon2), "sketch: 0x22 on");
+  dps_set_output(false);
+  check(same(sketch_sends(SET_OUTPUT), offoff2), "sketch: 0x22 off");
+
+  // set points the way the old dps_set_voltage_current() did them,
+  // current then voltage into poop[], against the 0x2C the sketch sends
+  // for the same values. ovp, ocp and the tail the sketch has read back
+  // off the supply by now have to be the ones poop[] always had
+  int bad = 0;
+  for (int i = 0; i < 50; i++) {
+    uint16_t v = rng() % (MAX_VOLTAGE + 1);
+    uint16_t c = rng() % (MAX_CURRENT + 1);
+    old_set_current(c);
+    old_set_voltage(v);
+    dps_set_voltage_current(v, c);
+    Buffer sent = sketch_sends(SET_SETPOINTS);
+    if (!same(sent, poop)) {
+      bad++;
+      if (verbose) {
+        printf("     %u/%u:", v, c);
+        for (size_t j = 0; j < FRAME_LEN; j++) printf(" %02X/%02X", sent[j], poop[j]);
+        printf("\n");
+      }
+    }
+  }
+  check(bad == 0, "sketch: 0x2C same as the old poop[] for 50 set points");
+  Serial1.tx = NULL;
+}
+
+// prof_percentile() on a few known histograms
+static void prof_checks(void) {
+  prof_region p = {};
+  for (int i = 0; i < 10; i++) {
+    p.hist[6]++;                  // 100 cycles, bucket [64, 128)
+    p.count++;
+  }
+  p.max = 100;
+  check(prof_percentile(&p, 500) == 100 && prof_percentile(&p, 990) == 100, "prof: p50 and p99 no more than max");
+  p.max = 200;
+  p.hist[7] = 1;
+  check(prof_percentile(&p, 500) == 127, "prof: top of the bucket below max");
+
+  // 70000 fast ones then 1000 slow, the fast bucket filled and got
+  // halved. hist[] has 38232 left against a count of 71000, the slow 1000
+  // are well over 1 percent of that
+  p = {};
+  p.hist[3] = 37232;              // 10 cycles
+  p.hist[9] = 1000;               // 1000 cycles
+  p.count = 71000;
+  p.max = 1000;
+  check(prof_percentile(&p, 500) == 15, "prof: p50 after halving");
+  check(prof_percentile(&p, 990) == 1000, "prof: p99 ranked on hist, not count");
+
+  p = {};
+  check(prof_percentile(&p, 500) == 0, "prof: nothing timed");
+}
+
+int main(int argc, char **argv) {
+  uint32_t seed = 5005;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:v")) != -1) {
+    switch (opt) {
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    case 'v': verbose = true; break;
+    default:
+      fprintf(stderr, "USAGE: wz5005-check [-s seed] [-v]\n");
+      return 1;
+    }
+  }
+  std::mt19937 rng(seed);
+
+  rx_checks(rng);
+  codec_checks(rng);
+  prof_checks();
+
+  printf("%d checks, %d failed\n", checks, failed);
+  return failed ? 1 : 0;
+}
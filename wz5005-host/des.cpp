@@ -0,0 +1,242 @@
+// wz5005-des - the sketch on the shims like wz5005-fw, but the link to
+// the supply is modelled byte by byte: each byte is on the wire for 10
+// bit times at the baud rate, tx and rx are separate wires that each
+// carry one byte at a time, and the supply starts answering a turnaround
+// after the last byte of a request is in. Everything runs off the
+// virtual clock in shim.cpp, so an hour of polling, a browser reading
+// /status.bin and someone fiddling with the set points replays in a few
+// seconds and comes out the same every time for the same seed
+//
+//   ./wz5005-des [-t minutes] [-b baud] [-T turnaround_us] [-S step_us]
+//                [-i read_ms] [-c control_ms] [-s seed] [-L load] [-e rate] [-E rate] [-d rate]
+//
+//   -t   simulated run time after boot (default 60 minutes)
+//   -b   link speed (default 9600)
+//   -T   supply turnaround, last request byte in to first reply byte out (default 2000us)
+//   -S   time between loop() calls (default 1000us)
+//   -i   how often the browser reads /status.bin (default 500ms)
+//   -c   how often a random set/on/off request comes in (default 10000ms)
+//
+// reports how stale /status.bin was when read, how long a change took to
+// show up on it, and how busy each wire was
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "ESP8266WebServer.h"
+#include "shim.hpp"
+#include "psu.hpp"
+
+// from the sketch
+void setup(void);
+void loop(void);
+extern ESP8266WebServer server;
+
+// one direction of the uart. bytes queue up behind each other and land
+// at the far end one byte time after they start
+struct wire {
+  uint64_t byte_us;
+  uint64_t free_at;           // when the last queued byte is done
+  uint64_t busy_us;           // time spent carrying bytes since stats were last reset
+  uint64_t bytes;
+  void (*deliver)(uint8_t c);
+};
+
+static struct psu psu;
+static wire tx, rx;
+static uint64_t turnaround = 2000;
+
+static void wire_send(wire *w, const uint8_t *p, size_t n, uint64_t earliest) {
+  for (size_t i = 0; i < n; i++) {
+    uint64_t start = std::max(earliest, w->free_at);
+    w->free_at = start + w->byte_us;
+    w->busy_us += w->byte_us;
+    w->bytes++;
+    uint8_t c = p[i];
+    void (*deliver)(uint8_t) = w->deliver;
+    shim_at(w->free_at, [deliver, c]() { deliver(c); });
+  }
+}
+
+static void at_psu(uint8_t c) {
+  psu_feed(&psu, c);
+}
+
+static void at_esp(uint8_t c) {
+  Serial.rx.push_back(c);
+}
+
+static void to_psu(void *, const uint8_t *p, size_t n) {
+  wire_send(&tx, p, n, shim_now());
+}
+
+static void from_psu(void *, const uint8_t *p, size_t n) {
+  wire_send(&rx, p, n, shim_now() + turnaround);
+}
+
+static long long now_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint16_t get16(const std::string &b, size_t at) {
+  return (uint8_t)b[at] | (uint8_t)b[at + 1] << 8;
+}
+
+static uint32_t get32(const std::string &b, size_t at) {
+  return get16(b, at) | (uint32_t)get16(b, at + 2) << 16;
+}
+
+static void percentiles(const char *what, std::vector<uint32_t> &v) {
+  if (v.empty()) {
+    printf("%-16s none\n", what);
+    return;
+  }
+  std::sort(v.begin(), v.end());
+  uint64_t sum = 0;
+  for (uint32_t x : v) sum += x;
+  printf("%-16s n=%zu mean %.1f p50 %u p99 %u max %u ms\n", what, v.size(),
+         (double)sum / v.size(), v[v.size() / 2], v[v.size() * 99 / 100], v.back());
+}
+
+// a change someone asked for, waiting to show up on /status.bin
+struct change {
+  bool active;
+  int what;                   // 0 uset, 1 iset, 2 on, 3 off
+  uint16_t v;
+  uint64_t at;                // us
+};
+
+static bool visible(const change &c, const std::string &b) {
+  switch (c.what) {
+  case 0:  return get16(b, 2) == c.v;
+  case 1:  return get16(b, 4) == c.v;
+  case 2:  return get16(b, 20) != 0;
+  default: return get16(b, 20) == 0;
+  }
+}
+
+int main(int argc, char **argv) {
+  double minutes = 60;
+  unsigned long baud = 9600;
+  uint64_t step = 1000;
+  uint32_t read_ms = 500;
+  uint32_t control_ms = 10000;
+  uint32_t seed = 5005;
+  int opt;
+  psu_init(&psu, from_psu, NULL);
+  psu.load = LOAD_OPEN;
+  while ((opt = getopt(argc, argv, "t:b:T:S:i:c:s:L:e:E:d:")) != -1) {
+    switch (opt) {
+    case 't': minutes = atof(optarg); break;
+    case 'b': baud = strtoul(optarg, NULL, 0); break;
+    case 'T': turnaround = strtoull(optarg, NULL, 0); break;
+    case 'S': step = strtoull(optarg, NULL, 0); break;
+    case 'i': read_ms = strtoul(optarg, NULL, 0); break;
+    case 'c': control_ms = strtoul(optarg, NULL, 0); break;
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    case 'L':
+      if (!psu_parse_load(&psu, optarg)) {
+        fprintf(stderr, "bad load %s, want open, short, r:OHMS or cc:AMPS\n", optarg);
+        return 1;
+      }
+      break;
+    case 'e': psu.badreply = atof(optarg); break;
+    case 'E': psu.badrequest = atof(optarg); break;
+    case 'd': psu.dropbyte = atof(optarg); break;
+    default:
+      fprintf(stderr, "USAGE: wz5005-des [-t minutes] [-b baud] [-T turnaround_us] [-S step_us] "
+                      "[-i read_ms] [-c control_ms] [-s seed] [-L load] [-e rate] [-E rate] [-d rate]\n");
+      return 1;
+    }
+  }
+  if (!baud || !step || !read_ms || !control_ms) {
+    fprintf(stderr, "baud, step, read and control intervals must not be 0\n");
+    return 1;
+  }
+  psu.rng.seed(seed);
+  std::mt19937 rng(seed);
+
+  tx = { (10000000ULL + baud / 2) / baud, 0, 0, 0, at_psu };
+  rx = { (10000000ULL + baud / 2) / baud, 0, 0, 0, at_esp };
+  Serial1.tx = to_psu;
+  shim_fs_load(FW "/data");
+  setup();
+  // boot chatter isnt what we are measuring
+  for (int i = 0; i < 1000; i++) {
+    loop();
+    shim_advance(1000);
+  }
+  tx.busy_us = rx.busy_us = tx.bytes = rx.bytes = 0;
+
+  uint64_t start = shim_now();
+  uint64_t end = start + (uint64_t)(minutes * 60e6);
+  uint64_t next_read = start;
+  uint64_t next_control = start + control_ms * 1000ULL;
+  std::vector<uint32_t> ages, shows;
+  change pending = {};
+  int reads = 0, failed = 0, lost = 0;
+  uint32_t digest = 2166136261u;  // fnv-1a over every /status.bin body read
+  long long t = now_ns();
+
+  while (shim_now() < end) {
+    loop();
+    shim_advance(step);
+    uint64_t now = shim_now();
+
+    if (now >= next_control) {
+      next_control += control_ms * 1000ULL;
+      if (pending.active) {
+        lost++; // never showed before the next one came in
+      }
+      change c = { true, (int)(rng() % 4), (uint16_t)(rng() % 4999), now };
+      char uri[32];
+      if (c.what == 0) snprintf(uri, sizeof(uri), "/uset?v=%u", c.v);
+      else if (c.what == 1) snprintf(uri, sizeof(uri), "/iset?v=%u", c.v);
+      else snprintf(uri, sizeof(uri), c.what == 2 ? "/onoff?v=1" : "/offon?v=1");
+      pending = server.request(HTTP_GET, uri) == 200 ? c : change{};
+    }
+
+    // while a change is outstanding look every step so the time it took
+    // is exact to the step, otherwise at the browser's pace
+    if (now >= next_read || pending.active) {
+      std::string body;
+      if (server.request(HTTP_GET, "/status.bin", &body) != 200 || body.size() != 32) {
+        failed++;
+      } else {
+        if (now >= next_read) {
+          next_read += read_ms * 1000ULL;
+          reads++;
+          ages.push_back(get32(body, 28));
+          for (char ch : body) digest = (digest ^ (uint8_t)ch) * 16777619u;
+        }
+        if (pending.active && visible(pending, body)) {
+          shows.push_back((uint32_t)((now - pending.at) / 1000));
+          pending.active = false;
+        }
+      }
+    }
+  }
+
+  double wall = (now_ns() - t) / 1e9;
+  double span = (double)(end - start);
+  printf("simulated %.1f min in %.2fs wall (%.0fx), %lu baud, turnaround %lluus, loop every %lluus\n",
+         minutes, wall, span / 1e6 / wall, baud, (unsigned long long)turnaround, (unsigned long long)step);
+  printf("bus tx %.1f%% (%llu bytes), rx %.1f%% (%llu bytes)\n",
+         100.0 * tx.busy_us / span, (unsigned long long)tx.bytes,
+         100.0 * rx.busy_us / span, (unsigned long long)rx.bytes);
+  percentiles("status age", ages);
+  percentiles("set to visible", shows);
+  printf("%d reads, %d failed, %d changes never seen, digest %08x\n", reads, failed, lost, digest);
+  std::string body;
+  server.request(HTTP_GET, "/diag/psu", &body);
+  printf("/diag/psu %s\n", body.c_str());
+  return 0;
+}
@@ -0,0 +1,863 @@
+// wz5005-fw - the sketch itself (setup(), loop() and every handler) built
+// for linux against the shims in shim/, with Serial1 tx and Serial rx
+// wired to the simulated supply from psu.cpp. Times the http handlers,
+// then runs randomized control sequences thru them and checks after each
+// one that the supply ended up where the requests said and /status.bin
+// agrees, the same again thru modbus-tcp from several masters at once,
+// the flash log held still under a slow download, /events listeners on
+// slow and stalled links, a host tool on the tcp bridge sharing the
+// bus with the poller, and /metrics against /diag/link.
+// Time is virtual, 1ms per loop(), the uart is instant
+//
+//   ./wz5005-fw [-n sequences] [-r requests] [-s seed] [-L load] [-e rate] [-E rate] [-d rate] [-v]
+//
+//   -n        control sequences to run (default 5000)
+//   -r        requests per handler for the timing pass (default 20000)
+//   -L load   as wz5005-sim, default open so nothing trips
+//   -e/-E/-d  reply checksum / request checksum / dropped byte rates
+//   -v        show the sketch's debug prints, the bus traffic and at the
+//             end what the poller traced
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "ESP8266WebServer.h"
+#include "FS.h"
+#include "history.hpp"
+#include "shim.hpp"
+#include "psu.hpp"
+#include "downloads.hpp"
+#include "dps.hpp"
+#include "modbus.hpp"
+#include "prof.hpp"
+#include "settings.h"
+#include "tlog.hpp"
+#include "trace.hpp"
+
+// from the sketch
+void setup(void);
+void loop(void);
+extern ESP8266WebServer server;
+
+#define STEP_US 1000        // virtual time per loop()
+#define SETTLE_MS 3000      // give up on a sequence after this long
+
+static struct psu psu;
+static bool verbose = false;
+static uint64_t psu_bytes = 0;      // sent to the supply
+
+static void to_psu(void *, const uint8_t *p, size_t n) {
+  psu_bytes += n;
+  for (size_t i = 0; i < n; i++) psu_feed(&psu, p[i]);
+}
+
+static void from_psu(void *, const uint8_t *p, size_t n) {
+  Serial.rx.insert(Serial.rx.end(), p, p + n);
+}
+
+static void to_console(void *, const uint8_t *p, size_t n) {
+  if (verbose) fwrite(p, 1, n, stdout);
+}
+
+static void run(uint32_t ms) {
+  for (uint32_t i = 0; i < ms * 1000 / STEP_US; i++) {
+    loop();
+    shim_advance(STEP_US);
+  }
+}
+
+static long long now_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// request() and then whatever the handler left to downloads_tick()
+static int fetch(const char *uri, std::string *body = NULL, const shim_headers &req = shim_headers(),
+                 shim_headers *reply = NULL) {
+  server.request(HTTP_GET, uri, NULL, req);
+  while (downloads_active()) {
+    downloads_tick();
+  }
+  return shim_response(server.last_conn()->out, body, reply);
+}
+
+static uint16_t get16(const std::string &b, size_t at) {
+  return (uint8_t)b[at] | (uint8_t)b[at + 1] << 8;
+}
+
+static uint16_t get16be(const std::string &b, size_t at) {
+  return (uint8_t)b[at] << 8 | (uint8_t)b[at + 1];
+}
+
+// wall clock per request thru the real handler, the loop keeps running in
+// between (untimed) so queues drain and snapshots move like on the device.
+// allocs is the Strings (the ones too long to keep inline) made per
+// request, parsing it included, each one a malloc on the esp
+static void time_handlers(int reqs, std::mt19937 &rng) {
+  static const char *uris[] = {
+    "/status", "/status.bin", "/devices", "/history?since=0", "/diag/psu", "/diag/link",
+    "/diag/heap", "/diag/trace", "/diag/latency", "/metrics", "/log", "/uset?v=", "/iset?v=", "/onoff?v=1", "/offon?v=1", "/jquery.min.js",
+  };
+  printf("%-18s %9s %9s %9s %7s %7s\n", "handler", "mean ns", "p50 ns", "p99 ns", "bytes", "allocs");
+  for (const char *base : uris) {
+    std::vector<long long> ns;
+    size_t bytes = 0;
+    unsigned long allocs = 0;
+    for (int i = 0; i < reqs; i++) {
+      std::string uri = base;
+      if (uri.back() == '=') uri += std::to_string(rng() % 4999);
+      std::string body;
+      unsigned long a = shim_string_allocs;
+      long long t = now_ns();
+      fetch(uri.c_str(), &body);
+      ns.push_back(now_ns() - t);
+      allocs += shim_string_allocs - a;
+      bytes = body.size();
+      loop();
+      shim_advance(STEP_US);
+    }
+    std::sort(ns.begin(), ns.end());
+    long long sum = 0;
+    for (long long v : ns) sum += v;
+    printf("%-18s %9lld %9lld %9lld %7zu %7.1f\n", base, sum / (long long)ns.size(),
+           ns[ns.size() / 2], ns[ns.size() * 99 / 100], bytes, (double)allocs / reqs);
+  }
+}
+
+// what a first visit and a reload of the page cost: the page and the
+// three libraries it pulls in. plain is a browser without gzip (what every
+// browser got before the .gz files), cold is a first visit with gzip and
+// warm is a reload where every etag still matches
+static void page_load(void) {
+  static const char *files[] = { "/", "/bootstrap.min.css", "/jquery.min.js", "/Chart.bundle.min.js" };
+  std::string etags[4];
+  const char *passes[] = { "plain", "cold", "warm" };
+  printf("%-6s %8s %10s %10s %s\n", "load", "wall us", "sent", "flash read", "status");
+  for (int p = 0; p < 3; p++) {
+    uint64_t sent = 0;
+    uint64_t read = shim_fs_read_bytes;
+    std::string codes;
+    long long t = now_ns();
+    for (int i = 0; i < 4; i++) {
+      shim_headers req, reply;
+      if (p > 0) req.push_back({ "Accept-Encoding", "gzip, deflate" });
+      if (p == 2) req.push_back({ "If-None-Match", etags[i] });
+      int code = fetch(files[i], NULL, req, &reply);
+      sent += server.last_conn()->out.size();
+      for (auto &h : reply) {
+        if (h.first == "ETag") etags[i] = h.second;
+      }
+      codes += (i ? " " : "") + std::to_string(code);
+    }
+    printf("%-6s %8lld %10llu %10llu %s\n", passes[p], (now_ns() - t) / 1000, (unsigned long long)sent,
+           (unsigned long long)(shim_fs_read_bytes - read), codes.c_str());
+  }
+
+  // a new index.html thru /deploy has to invalidate the old etag
+  std::string page;
+  fetch("/", &page);
+  page += "<!-- deployed -->";
+  server.upload("/deploy", "index.html", (const uint8_t *)page.data(), page.size());
+  shim_headers req = { { "If-None-Match", etags[0] } }, reply;
+  std::string body;
+  int code = fetch("/", &body, req, &reply);
+  printf("after /deploy: %d, %s\n", code, code == 200 && body == page ? "new page" : "STALE");
+}
+
+// /diag/trace decoded, the records the poller kept since boot (or the
+// last TRACE_LEN of them)
+static void dump_trace(void) {
+  static const char *names[] = {
+    "overwritten", "boot", "timeout", "badframe", "nack", "retry", "giveup", "send", "found", "lost", "stats", "bridge",
+    "noasset",
+  };
+  std::string body;
+  if (fetch("/diag/trace", &body) != 200 || body.size() < 8) {
+    printf("no /diag/trace\n");
+    return;
+  }
+  uint32_t first, next;
+  memcpy(&first, body.data(), 4);
+  memcpy(&next, body.data() + 4, 4);
+  printf("trace %u to %u\n", first, next);
+  for (size_t at = 8; at + sizeof(trace_rec) <= body.size(); at += sizeof(trace_rec)) {
+    trace_rec r;
+    memcpy(&r, body.data() + at, sizeof(r));
+    printf("%10.3f ms %-11s %5u %5u %5u %5u\n", r.t / 1000.0,
+           r.id < sizeof(names) / sizeof(names[0]) ? names[r.id] : "?", r.arg[0], r.arg[1], r.arg[2], r.arg[3]);
+  }
+}
+
+// what the page asks for on load, the last 30 s of /history, with a
+// voltage change in it and loop() stalling for 1.5 s a few times after.
+// every row has to say what the supply had at its time, so the row
+// times have to be when the samples were really taken, and only the
+// rows asked for come back. early is how many records there were a
+// second after boot, the time before the first loop() mustnt be in them
+static int history_check(int early) {
+  run(30000);
+  server.request(HTTP_GET, "/uset?v=1200");
+  run(3000);
+  uint32_t change = millis();
+  server.request(HTTP_GET, "/uset?v=3400");
+  for (int i = 0; i < 5; i++) {
+    run(300);
+    delay(1500);
+  }
+  run(2000);
+  char uri[64];
+  snprintf(uri, sizeof(uri), "/history?since=%lu&step=1000", (unsigned long)(millis() - 30000));
+  std::string body;
+  int rows = 0, wrong = 0;
+  unsigned long t = 0, uset = 0;
+  if (fetch(uri, &body) == 200) {
+    for (size_t at = body.find("[["); at != std::string::npos; at = body.find(",[", at + 1)) {
+      if (sscanf(body.c_str() + at + 2, "%lu,%lu", &t, &uset) != 2) break;
+      rows++;
+      // the poller has a new setpoint a few hundred ms after it was set
+      int32_t after = t - change;
+      if ((after >= -2000 && after < 0 && uset != 1200) || (after >= 1000 && uset != 3400)) wrong++;
+    }
+  }
+  int failed = rows < 20 || rows > 31 || wrong || millis() - t > 1000 || early > 1;
+  printf("history: %d after the first second, %d rows for the last 30 s, %d with the wrong setpoint for their time, "
+         "newest %lu ms old, %d failed\n", early, rows, wrong, millis() - t, failed);
+  return failed;
+}
+
+static size_t file_size(const char *name) {
+  File f = SPIFFS.open(name, "r");
+  return f ? f.size() : 0;
+}
+
+// the BOOT record has to be on flash as soon as setup() is done, in a
+// write that leaves /log0.bin on a page boundary for the ones after it.
+// /log0.bin must not be rotated while a slow /log?file=0 is reading it.
+// it is made full first, a page is flushed every 16 records, the
+// download takes longer than that. what comes down has to be the file
+// as it was, and once the download is gone the next flush rotates
+static int tlog_check(bool booted) {
+  char name[16];
+  tlog_name(name, 0);
+  size_t full = TLOG_FILE_SIZE - file_size(name);
+  File f = SPIFFS.open(name, "a");
+  std::vector<uint8_t> pad(full, 0);
+  if (f) f.write(pad.data(), pad.size());
+  f.close();
+  f = SPIFFS.open(name, "r");
+  std::string before(file_size(name), 0);
+  if (f) f.read((uint8_t *)&before[0], before.size());
+  f.close();
+
+  auto slow = std::make_shared<shim_conn>();
+  slow->rate = 200;
+  slow->rtt = 30000;
+  server.connect(slow, HTTP_GET, "/log?file=0", shim_headers());
+  uint32_t page = TLOG_PAGE / sizeof(tlog_record) * TLOG_INTERVAL;
+  run(page + TLOG_INTERVAL);
+  size_t grown = file_size(name);
+  size_t at = slow->out.find("\r\n\r\n");
+  std::string got = at == std::string::npos ? "" : slow->out.substr(at + 4);
+  bool same = got.size() > 0 && got.size() < before.size() && before.compare(0, got.size(), got) == 0;
+  slow->open = false;
+  run(page + TLOG_INTERVAL);
+  size_t after = file_size(name);
+
+  // a power cut in the middle of a write left 250 bytes, part of a
+  // record. the next boot has to get back onto records and pages
+  tlog_flush();
+  SPIFFS.remove(name);
+  f = SPIFFS.open(name, "a");
+  std::vector<uint8_t> torn(250, 0x5A);
+  if (f) f.write(torn.data(), torn.size());
+  f.close();
+  tlog_begin();
+  size_t mended = file_size(name);
+  tlog_record r = {};
+  f = SPIFFS.open(name, "r");
+  if (f && f.seek(256)) f.read((uint8_t *)&r, sizeof(r));
+  f.close();
+  bool remade = mended == 2 * TLOG_PAGE && r.t == TLOG_MAGIC_BOOT;
+
+  int failed = !booted + (grown <= TLOG_FILE_SIZE || grown % TLOG_PAGE) + !same +
+               (after >= TLOG_FILE_SIZE || after % TLOG_PAGE) + !remade;
+  printf("tlog: BOOT %s; /log0.bin %u while downloading, %u bytes down %s, %u after it; torn at 250, %u after "
+         "BOOT%s; %d failed\n", booted ? "on flash, page aligned" : "NOT ON FLASH OR SHORT", (unsigned)grown,
+         (unsigned)got.size(), same ? "as they were" : "CHANGED", (unsigned)after, (unsigned)mended,
+         remade ? "" : " NOT ON A RECORD AND PAGE", failed);
+  return failed;
+}
+
+// /metrics against /diag/link for the uart counters, and a latency
+// _sum past 2^32 ms, 60 days of cycles in one region. then 60 days of a
+// loop() a day, millis() wraps on the way and the uptime and the flash
+// log's record times mustnt, and a
+// reply read a day late is a timeout, not a day long round trip. there
+// is no temperature until the 0x2A reply is understood, and no input
+// voltage, no reply the poller asks for carries it
+static int metrics_check(void) {
+  uint64_t days = 60;
+  prof_regions[PROF_TLOG].sum += days * 86400 * 1000 * 1000 * ESP.getCpuFreqMHz();
+  std::string m, link;
+  fetch("/metrics", &m);
+  server.request(HTTP_GET, "/diag/link", &link);
+  int failed = 0;
+  double sum = 0;
+  size_t at = m.find("\nwz5005_latency_seconds_sum{region=\"tlog\"} ");
+  if (at == std::string::npos || sscanf(m.c_str() + m.find("} ", at) + 2, "%lf", &sum) != 1 || sum < days * 86400) {
+    failed++;
+  }
+  if (m.find("temperature") != std::string::npos || m.find("input_volts") != std::string::npos) {
+    failed++;
+  }
+  static const char *const pairs[][2] = {
+    { "\nwz5005_uart_frames_total ", "\"frames\":" },
+    { "\nwz5005_uart_timeouts_total ", "\"timeouts\":" },
+    { "\nwz5005_uart_acks_total{code=\"ok\"} ", "\"acks\":" },
+    { "\nwz5005_uart_acks_total{code=\"other\"} ", "\"othererr\":" },
+    { "\nwz5005_set_giveups_total ", "\"giveups\":" },
+  };
+  int differ = 0;
+  for (const auto &p : pairs) {
+    size_t a = m.find(p[0]), b = link.find(p[1]);
+    if (a == std::string::npos || b == std::string::npos ||
+        strtoul(m.c_str() + a + strlen(p[0]), NULL, 10) != strtoul(link.c_str() + b + strlen(p[1]), NULL, 10)) {
+      differ++;
+    }
+  }
+  failed += differ;
+  std::string later;
+  for (uint64_t d = 0; d < days; d++) {
+    delay(86400 * 1000);
+    run(1);
+  }
+  fetch("/metrics", &later);
+  uint32_t slowest = 0;
+  for (int r = PROF_UART_STATUS; r <= PROF_UART_SET; r++) {
+    prof_region p;
+    if (prof_get(r, &p)) slowest = std::max(slowest, p.max);
+  }
+  slowest /= ESP.getCpuFreqMHz() * 1000;
+  if (slowest > DPS_REPLY_TIMEOUT_MAX) {
+    failed++;
+  }
+  unsigned long up = 0;
+  at = later.find("\nwz5005_uptime_seconds ");
+  if (at == std::string::npos || sscanf(later.c_str() + at + 23, "%lu", &up) != 1 || up < days * 86400) {
+    failed++;
+  }
+  // the newest log record, still waiting for its page or on flash
+  tlog_record newest = {};
+  int pending;
+  const uint8_t *p = tlog_pending(&pending);
+  if (pending) {
+    memcpy(&newest, p + pending - sizeof(newest), sizeof(newest));
+  } else {
+    char name[16];
+    tlog_name(name, 0);
+    File f = SPIFFS.open(name, "r");
+    if (f && f.size() >= sizeof(newest) && f.seek(f.size() - sizeof(newest))) f.read((uint8_t *)&newest, sizeof(newest));
+  }
+  if (newest.t < days * 86400) {
+    failed++;
+  }
+  printf("metrics: tlog _sum %.0f s after adding %llu days, uart counters %s /diag/link, uptime %lu s %llu days "
+         "on, last log record at %lu s, slowest round trip %lu ms, %d failed\n", sum, (unsigned long long)days,
+         differ ? "DIFFER FROM" : "same as", up, (unsigned long long)days, (unsigned long)newest.t,
+         (unsigned long)slowest, failed);
+  return failed;
+}
+
+struct want {
+  uint16_t uset;
+  uint16_t iset;
+  bool on;
+};
+
+static bool settled(const want &w) {
+  if (psu.setp.uset != w.uset || psu.setp.iset != w.iset || psu.on != w.on) return false;
+  std::string body;
+  if (server.request(HTTP_GET, "/status.bin", &body) != 200 || body.size() != 32) return false;
+  return get16(body, 2) == w.uset && get16(body, 4) == w.iset && (get16(body, 20) != 0) == w.on;
+}
+
+// a burst of 1-6 random set/on/off requests, with a few loop()s between
+// some of them, then run until the supply and the snapshot both match
+static int sequences(int n, std::mt19937 &rng) {
+  want w = { psu.setp.uset, psu.setp.iset, psu.on };
+  int failed = 0;
+  long long total_ms = 0;
+  uint32_t worst_ms = 0;
+  long long t = now_ns();
+  for (int s = 0; s < n; s++) {
+    int ops = 1 + rng() % 6;
+    for (int i = 0; i < ops; i++) {
+      char uri[32];
+      int v = rng() % 4999;
+      int what = rng() % 4;
+      if (what == 0) snprintf(uri, sizeof(uri), "/uset?v=%d", v);
+      else if (what == 1) snprintf(uri, sizeof(uri), "/iset?v=%d", v);
+      else snprintf(uri, sizeof(uri), what == 2 ? "/onoff?v=1" : "/offon?v=1");
+      if (server.request(HTTP_GET, uri) == 200) {
+        if (what == 0) w.uset = v;
+        else if (what == 1) w.iset = v;
+        else w.on = what == 2;
+      }
+      run(rng() % 4);
+    }
+    uint32_t ms = 0;
+    while (!settled(w) && ms < SETTLE_MS) {
+      run(1);
+      ms++;
+    }
+    if (ms >= SETTLE_MS) {
+      failed++;
+      // start the next one from wherever it really is
+      w = { psu.setp.uset, psu.setp.iset, psu.on };
+    }
+    total_ms += ms;
+    worst_ms = std::max(worst_ms, ms);
+  }
+  double secs = (now_ns() - t) / 1e9;
+  printf("%d sequences in %.2fs wall, %.0f/s, settle mean %.1f ms worst %u ms virtual, %d failed\n",
+         n, secs, n / secs, (double)total_ms / n, worst_ms, failed);
+  return failed;
+}
+
+// a modbus-tcp master on its own connection to the sketch
+struct master {
+  std::shared_ptr<shim_conn> c;
+  size_t seen;          // bytes of c->out already taken as replies
+  uint16_t tid;
+};
+
+static master mb_connect(void) {
+  master m = { std::make_shared<shim_conn>(), 0, 0 };
+  shim_tcp_connect(MODBUS_PORT, m.c);
+  run(1);
+  return m;
+}
+
+// request fn with body on unit 1, the reply pdu back, empty if none came
+// within a few loop()s
+static std::string mb_call(master &m, uint8_t fn, const std::string &body) {
+  std::string adu = { (char)(++m.tid >> 8), (char)m.tid, 0, 0, (char)((body.size() + 2) >> 8),
+                      (char)(body.size() + 2), 1, (char)fn };
+  m.c->in += adu + body;
+  for (int i = 0; i < 5 && m.c->out.size() < m.seen + 8; i++) {
+    run(1);
+  }
+  if (m.c->out.size() < m.seen + 8) {
+    return std::string();
+  }
+  size_t len = 6 + get16be(m.c->out, m.seen + 4);
+  std::string pdu = m.c->out.substr(m.seen + 7, len - 7);
+  m.seen += len;
+  return pdu;
+}
+
+static std::string be16(uint16_t v) {
+  return std::string({ (char)(v >> 8), (char)v });
+}
+
+// does the register map say what the supply has, with the spares at 0
+static bool mb_settled(master &m, const want &w) {
+  if (psu.setp.uset != w.uset || psu.setp.iset != w.iset || psu.on != w.on) return false;
+  std::string r = mb_call(m, 0x03, be16(MB_USET) + be16(MB_REGS));
+  return r.size() == 2 + MB_REGS * 2 && get16be(r, 2 + MB_USET * 2) == w.uset &&
+         get16be(r, 2 + MB_ISET * 2) == w.iset && (get16be(r, 2 + MB_ONOFF * 2) != 0) == w.on &&
+         get16be(r, 2 + MB_SPARE_UIN * 2) == 0 && get16be(r, 2 + MB_SPARE_TEMP * 2) == 0;
+}
+
+// the random sequences again, each write from one of MB_MASTERS masters
+// picked at random, as single registers (0x06) or uset and iset in one
+// go (0x10). then the bus load with every master reading the whole map
+// every loop() against nobody asking, reads come from the snapshot so it
+// should be the same
+#define MB_MASTERS 3
+
+static int modbus_sequences(int n, std::mt19937 &rng) {
+  master ms[MB_MASTERS];
+  for (master &m : ms) m = mb_connect();
+  want w = { psu.setp.uset, psu.setp.iset, psu.on };
+  int failed = 0, refused = 0;
+  long long total_ms = 0;
+  for (int s = 0; s < n; s++) {
+    int ops = 1 + rng() % 6;
+    for (int i = 0; i < ops; i++) {
+      master &m = ms[rng() % MB_MASTERS];
+      uint16_t v = rng() % 4999, v2 = rng() % 4999;
+      std::string r;
+      switch (rng() % 4) {
+      case 0:
+        r = mb_call(m, 0x06, be16(MB_USET) + be16(v));
+        if (r.size() == 5 && r[0] == 0x06) w.uset = v;
+        break;
+      case 1:
+        r = mb_call(m, 0x06, be16(MB_ISET) + be16(v));
+        if (r.size() == 5 && r[0] == 0x06) w.iset = v;
+        break;
+      case 2:
+        r = mb_call(m, 0x10, be16(MB_USET) + be16(2) + std::string(1, 4) + be16(v) + be16(v2));
+        if (r.size() == 5 && r[0] == 0x10) w.uset = v, w.iset = v2;
+        break;
+      default:
+        v &= 1;
+        r = mb_call(m, 0x06, be16(MB_ONOFF) + be16(v));
+        if (r.size() == 5 && r[0] == 0x06) w.on = v;
+        break;
+      }
+      if (r.empty() || (r[0] & 0x80)) refused++;
+      run(rng() % 4);
+    }
+    uint32_t start = millis();
+    while (!mb_settled(ms[0], w) && millis() - start < SETTLE_MS) {
+      run(1);
+    }
+    if (millis() - start >= SETTLE_MS) {
+      failed++;
+      w = { psu.setp.uset, psu.setp.iset, psu.on };
+    }
+    total_ms += millis() - start;
+  }
+
+  // lock has nothing to poll, it has to read back what was written once
+  // the supply has taken it. setup() left it in remote
+  bool lock = true;
+  for (int v : { 0, 1 }) {
+    std::string r = mb_call(ms[0], 0x03, be16(MB_LOCK) + be16(1));
+    lock &= r.size() == 4 && get16be(r, 2) == !v;
+    mb_call(ms[0], 0x06, be16(MB_LOCK) + be16(v));
+    run(500);
+    r = mb_call(ms[0], 0x03, be16(MB_LOCK) + be16(1));
+    lock &= r.size() == 4 && get16be(r, 2) == v && psu.remote == v;
+  }
+  failed += !lock;
+
+  uint64_t b = psu_bytes;
+  run(5000);
+  uint64_t idle = psu_bytes - b;
+  int reads = 0;
+  b = psu_bytes;
+  for (int t = 0; t < 5000; t++) {
+    for (master &m : ms) {
+      m.c->in += std::string({ 0, 1, 0, 0, 0, 6, 1, 3 }) + be16(0) + be16(MB_REGS);
+      reads++;
+    }
+    run(1);
+  }
+  uint64_t busy = psu_bytes - b;
+  run(10);
+  for (master &m : ms) m.seen = m.c->out.size();
+
+  // a master that pipelines whole map reads on a link that takes 10 B/s,
+  // then stops reading altogether. loop() mustnt wait on it, the others
+  // still get answers, and once it has stopped it is dropped after
+  // MODBUS_IDLE
+  master stuck = mb_connect();
+  stuck.c->rate = 10;
+  stuck.c->rtt = 30000;
+  for (int i = 0; i < 200; i++) {
+    stuck.c->in += std::string({ 0, 1, 0, 0, 0, 6, 1, 3 }) + be16(0) + be16(MB_REGS);
+  }
+  uint64_t worst = 0, since = shim_now();
+  int answered = 0;
+  size_t trickled = 0;
+  for (int i = 0; stuck.c->open && shim_now() - since < (MODBUS_IDLE + 15000) * 1000ULL; i++) {
+    uint64_t t = shim_now();
+    loop();
+    worst = std::max(worst, shim_now() - t);
+    shim_advance(STEP_US);
+    if (i < 10000 && i % 1000 == 0) {
+      answered += mb_call(ms[0], 0x03, be16(MB_USET) + be16(1)).size() == 4;
+    }
+    if (i == 10000) {
+      trickled = stuck.c->out.size();
+      stuck.c->limit = trickled;
+    }
+  }
+  bool stalled = worst > 10000 || answered < 10 || !trickled || stuck.c->open;
+  failed += stalled;
+  printf("modbus: %d sequences, settle mean %.1f ms, %d failed, %d refused; lock %s; bus %.1f frames/s idle, "
+         "%.1f with %d reads/s; stalled master: longest loop() %.1f ms, %zu bytes in 10 s, %s\n", n, (double)total_ms / n, failed,
+         refused, lock ? "reads back" : "WRONG", idle / 20 / 5.0, busy / 20 / 5.0, reads / 5, worst / 1000.0,
+         trickled, stuck.c->open ? "STILL THERE" : "dropped");
+  return failed;
+}
+
+// pages on /events over a slow link, one that has stopped taking data
+// and a fast one. loop() must never wait on either of the first two, the
+// slow one gets what fits, the stalled one is dropped after SSE_MISSED
+// events and the fast one gets every event
+static int count_events(const std::string &out) {
+  int n = 0;
+  for (size_t at = 0; (at = out.find("data: ", at)) != std::string::npos; at++) n++;
+  return n;
+}
+
+static int sse_run(void) {
+  int failed = 0;
+  auto slow = std::make_shared<shim_conn>();
+  slow->rate = 200;
+  slow->rtt = 30000;
+  auto stalled = std::make_shared<shim_conn>();
+  stalled->rate = 1;
+  stalled->rtt = 30000;
+  auto fast = std::make_shared<shim_conn>();
+  server.connect(slow, HTTP_GET, "/events", shim_headers());
+  server.connect(stalled, HTTP_GET, "/events", shim_headers());
+  server.connect(fast, HTTP_GET, "/events", shim_headers());
+  uint64_t start = shim_now(), dropped = 0, worst = 0;
+  for (int i = 0; i < 10000; i++) {
+    uint64_t t = shim_now();
+    loop();
+    worst = std::max(worst, shim_now() - t);
+    shim_advance(STEP_US);
+    if (!dropped && !stalled->open) dropped = shim_now();
+  }
+  int events = count_events(fast->out), some = count_events(slow->out);
+  if (!dropped || worst > 10000 || events < 50 || !fast->open || !slow->open || !some) failed++;
+  slow->open = fast->open = false;
+  run(10);
+  printf("events: longest loop() %.1f ms; %d events fast, %d on 200 B/s, stalled one %s %.1f s in, %d failed\n",
+         worst / 1000.0, events, some, dropped ? "dropped" : "STILL THERE",
+         dropped ? (dropped - start) / 1e6 : 0.0, failed);
+  return failed;
+}
+
+// a host tool on the tcp bridge asking for 0x29 flat out, one frame
+// after the other, then switching the output with a raw 0x22. the
+// poller has to get as many frames on the bus as it does with nobody on
+// the bridge, and a second client has to be turned away. an ack with an
+// error code (-E) is a reply all the same, it is counted apart. then a
+// frame to an address the poller doesnt know, its reply still has to
+// come back, and a client that hangs up with a frame on the wire, whose
+// reply mustnt reach the one that connects next
+static int bridge_run(void) {
+  int failed = 0;
+  uint64_t b = psu_bytes;
+  run(5000);
+  uint64_t idle = psu_bytes - b;
+
+  auto c = std::make_shared<shim_conn>();
+  shim_tcp_connect(BRIDGE_PORT, c);
+  auto other = std::make_shared<shim_conn>();
+  run(1);
+  shim_tcp_connect(BRIDGE_PORT, other);
+  run(1);
+  if (other->open) failed++;
+
+  wz5005::Buffer q = wz5005::frame(wz5005::GET_OUTPUT, 0, wz5005::DEFAULT_ADDR);
+  int frames = 0, lost = 0, ackerr = 0;
+  uint32_t worst_rt = 0;
+  uint64_t total_rt = 0;
+  uint32_t end = millis() + 5000;
+  b = psu_bytes;
+  while (millis() < end) {
+    size_t seen = c->out.size();
+    uint32_t sent = millis();
+    c->in.append((const char *)q.data(), q.size());
+    // longer than the poller waits for any reply, after that it isnt coming
+    while (c->out.size() < seen + wz5005::FRAME_LEN && millis() - sent < 2 * DPS_REPLY_TIMEOUT_MAX) {
+      run(1);
+    }
+    if (c->out.size() == seen) {
+      lost++;
+      continue;
+    }
+    uint8_t cmd = c->out.size() == seen + wz5005::FRAME_LEN ? (uint8_t)c->out[seen + 2] : 0;
+    if (cmd != wz5005::GET_OUTPUT && cmd != wz5005::ACK) {
+      failed++;
+      break;
+    }
+    ackerr += cmd == wz5005::ACK;
+    frames++;
+    total_rt += millis() - sent;
+    worst_rt = std::max(worst_rt, (uint32_t)(millis() - sent));
+  }
+
+  // whatever the bridge didnt send was the poller
+  uint64_t busy = psu_bytes - b - (uint64_t)frames * wz5005::FRAME_LEN;
+
+  // sent again while the supply says it got a bad checksum, like a host
+  // tool would
+  bool on = !psu.on, acked = false;
+  wz5005::Buffer set;
+  wz5005::encode(wz5005::SetOutput{ on }, set, wz5005::DEFAULT_ADDR);
+  uint32_t start = millis();
+  for (int tries = 0; !acked && tries < 5; tries++) {
+    size_t seen = c->out.size();
+    c->in.append((const char *)set.data(), set.size());
+    uint32_t sent = millis();
+    while (c->out.size() < seen + wz5005::FRAME_LEN && millis() - sent < 2 * DPS_REPLY_TIMEOUT_MAX) {
+      run(1);
+    }
+    if (c->out.size() == seen + wz5005::FRAME_LEN && (uint8_t)c->out[seen + 2] == wz5005::ACK) {
+      acked = (uint8_t)c->out[seen + 3] == ELSEHRM;
+      ackerr += !acked;
+    }
+  }
+  while (acked && (dps_snapshot()->onoff != 0) != on && millis() - start < SETTLE_MS) {
+    run(1);
+  }
+  uint32_t took = millis() - start;
+  if (!acked || psu.on != on || (dps_snapshot()->onoff != 0) != on) failed++;
+
+  // a frame with no command behind it, a checksum is all it needs to get
+  // thru the bridge's receiver. it mustnt take a bus slot it never gives
+  // back, after it the poller still polls and a set still goes out
+  wz5005::Buffer nothing = wz5005::frame(0, 0, wz5005::DEFAULT_ADDR);
+  size_t before = c->out.size();
+  c->in.append((const char *)nothing.data(), nothing.size());
+  run(2 * DPS_REPLY_TIMEOUT_MAX);
+  b = psu_bytes;
+  run(1000);
+  uint64_t after = psu_bytes - b;
+  dps_set_output(!on);
+  start = millis();
+  while (psu.on == on && millis() - start < SETTLE_MS) {
+    run(1);
+  }
+  bool wedged = c->out.size() != before || after == 0 || psu.on == on;
+  if (wedged) failed++;
+
+  // garbage from the client is dropped by the bridge's receiver, it isnt
+  // the supply's link going bad and mustnt show up in its trace
+  wz5005::Buffer junk = q;
+  junk[19] ^= 0x40;
+  uint32_t traced = trace_next();
+  c->in.append((const char *)junk.data(), junk.size());
+  run(10);
+  int badframes = 0;
+  for (uint32_t i = traced; i != trace_next(); i++) {
+    trace_rec r;
+    badframes += trace_get(i, &r) && r.id == TR_BADFRAME;
+  }
+  if (badframes) failed++;
+
+  // the supply moved off the poller's table for a moment
+  uint8_t away = wz5005::DEFAULT_ADDR + DPS_DEVICES;
+  psu.addr = away;
+  wz5005::Buffer ask = wz5005::frame(wz5005::GET_OUTPUT, 0, away);
+  bool stranger = false;
+  for (int tries = 0; !stranger && tries < 5; tries++) {
+    size_t seen = c->out.size();
+    c->in.append((const char *)ask.data(), ask.size());
+    uint32_t sent = millis();
+    while (c->out.size() < seen + wz5005::FRAME_LEN && millis() - sent < 2 * DPS_REPLY_TIMEOUT_MAX) {
+      run(1);
+    }
+    stranger = c->out.size() == seen + wz5005::FRAME_LEN && (uint8_t)c->out[seen + 1] == away &&
+               (uint8_t)c->out[seen + 2] == wz5005::GET_OUTPUT;
+  }
+  psu.addr = wz5005::DEFAULT_ADDR;
+  if (!stranger) failed++;
+
+  // hang up right after the frame has gone to the bridge, the next
+  // client connects while it is on the wire
+  c->in.append((const char *)q.data(), q.size());
+  run(1);
+  c->open = false;
+  auto next = std::make_shared<shim_conn>();
+  shim_tcp_connect(BRIDGE_PORT, next);
+  run(2 * DPS_REPLY_TIMEOUT_MAX);
+  bool leaked = !next->out.empty();
+  if (leaked || !next->open) failed++;
+  next->open = false;
+  run(10);
+
+  printf("bridge: %d frames in 5s, %d lost, %d acks with an error, round trip mean %.1f worst %u ms; "
+         "poller %.1f frames/s (%.1f with nobody on it); raw 0x22 %s in %u ms; command 0 %s; "
+         "garbage %s; other address %s; second client %s, next client %s, %d failed\n",
+         frames, lost, ackerr, frames ? (double)total_rt / frames : 0.0, worst_rt, busy / 20 / 5.0,
+         idle / 20 / 5.0, acked ? "acked and on the snapshot" : "LOST", (unsigned)took,
+         wedged ? "WEDGED THE POLLER" : "dropped", badframes ? "IN THE LINK TRACE" : "not traced",
+         stranger ? "answered" : "NOT ANSWERED", other->open ? "LET IN" : "refused",
+         leaked ? "GOT THE LAST ONES REPLY" : "clean", failed);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  int seqs = 5000;
+  int reqs = 20000;
+  uint32_t seed = 5005;
+  bool errors = false;
+  int opt;
+  psu_init(&psu, from_psu, NULL);
+  psu.load = LOAD_OPEN;
+  while ((opt = getopt(argc, argv, "n:r:s:L:e:E:d:v")) != -1) {
+    switch (opt) {
+    case 'n': seqs = atoi(optarg); break;
+    case 'r': reqs = atoi(optarg); break;
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    case 'L':
+      if (!psu_parse_load(&psu, optarg)) {
+        fprintf(stderr, "bad load %s, want open, short, r:OHMS or cc:AMPS\n", optarg);
+        return 1;
+      }
+      break;
+    case 'e': psu.badreply = atof(optarg); errors = true; break;
+    case 'E': psu.badrequest = atof(optarg); errors = true; break;
+    case 'd': psu.dropbyte = atof(optarg); errors = true; break;
+    case 'v': verbose = psu.verbose = true; break;
+    default:
+      fprintf(stderr, "USAGE: wz5005-fw [-n sequences] [-r requests] [-s seed] [-L load] [-e rate] [-E rate] [-d rate] [-v]\n");
+      return 1;
+    }
+  }
+  psu.rng.seed(seed);
+  std::mt19937 rng(seed);
+
+  Serial1.tx = to_psu;
+  Serial.tx = to_console;
+  shim_fs_load(FW "/data");
+  // the first loop() comes as late as it would after a slow wifi join
+  delay(8000);
+  setup();
+  bool booted = false;
+  char name[16];
+  tlog_name(name, 0);
+  File log = SPIFFS.open(name, "r");
+  tlog_record r;
+  while (log && log.read((uint8_t *)&r, sizeof(r)) == sizeof(r)) booted |= r.t == TLOG_MAGIC_BOOT;
+  // and padded out to a whole page
+  booted &= log && log.size() % TLOG_PAGE == 0;
+  log.close();
+  run(1000);
+  int early = history_count();
+  if (!settled({ psu.setp.uset, psu.setp.iset, psu.on })) {
+    fprintf(stderr, "supply never showed up on /status.bin\n");
+    return 1;
+  }
+
+  time_handlers(reqs, rng);
+  page_load();
+  int failed = history_check(early);
+  failed += tlog_check(booted);
+  failed += sequences(seqs, rng);
+  failed += modbus_sequences(seqs / 5, rng);
+  failed += sse_run();
+  failed += bridge_run();
+  failed += metrics_check();
+
+  std::string body;
+  server.request(HTTP_GET, "/diag/link", &body);
+  printf("/diag/link %s\n", body.c_str());
+  fetch("/diag/latency", &body);
+  printf("/diag/latency %s\n", body.c_str());
+  if (verbose) {
+    fetch("/metrics", &body);
+    printf("%s", body.c_str());
+  }
+  if (verbose) {
+    dump_trace();
+  }
+  return failed && !errors ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+// wz5005-httpload - the sketch's web server with several browsers on slow
+// links, on the virtual clock like wz5005-des. each browser loads the
+// page cold (index.html, then the three libraries and /history at once
+// like a browser opens connections), reads /status.bin every -i ms for a
+// while and loads the page again. on a fast link next to them someone
+// watches /status.bin every 100ms and sets the voltage once a second, how
+// long they wait is what a slow download costs everyone else
+//
+//   ./wz5005-httpload [-b browsers] [-r KB/s] [-R rtt_ms] [-i read_ms] [-t seconds] [-s seed]
+//
+// make builds it twice, wz5005-httpload with the downloads fed from loop()
+// and wz5005-httpload-inline with DOWNLOADS_MAX 0, where the handler
+// writes the whole body before the next request is looked at
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "ESP8266WebServer.h"
+#include "shim.hpp"
+#include "psu.hpp"
+#include "downloads.hpp"
+
+// from the sketch
+void setup(void);
+void loop(void);
+extern ESP8266WebServer server;
+
+#define STEP_US 1000        // virtual time between loop() calls
+#define WATCH_MS 100        // the watcher's /status.bin, give or take 10
+#define SET_MS 1000         // and its /uset
+#define RELOAD_MIN 10       // s a browser stays on the page before loading it again
+#define RELOAD_MAX 30
+
+static struct psu psu;
+
+static void to_psu(void *, const uint8_t *p, size_t n) {
+  for (size_t i = 0; i < n; i++) psu_feed(&psu, p[i]);
+}
+
+static void from_psu(void *, const uint8_t *p, size_t n) {
+  Serial.rx.insert(Serial.rx.end(), p, p + n);
+}
+
+static uint32_t get32(const std::string &b, size_t at) {
+  return (uint8_t)b[at] | (uint8_t)b[at + 1] << 8 | (uint8_t)b[at + 2] << 16 | (uint32_t)(uint8_t)b[at + 3] << 24;
+}
+
+static void percentiles(const char *what, std::vector<uint32_t> &v) {
+  if (v.empty()) {
+    printf("%-14s none\n", what);
+    return;
+  }
+  std::sort(v.begin(), v.end());
+  uint64_t sum = 0;
+  for (uint32_t x : v) sum += x;
+  printf("%-14s n=%-6zu mean %7.1f p50 %6u p99 %6u max %6u ms\n", what, v.size(),
+         (double)sum / v.size(), v[v.size() / 2], v[v.size() * 99 / 100], v.back());
+}
+
+enum { GET_INDEX, GET_PAGE, GET_STATUS, WATCH_STATUS, WATCH_SET };
+
+struct browser {
+  int loading;                // page requests still out, 0 once the page is up
+  uint64_t started;           // us, this page load
+  uint64_t next_read;
+  uint64_t reload;
+  bool reading;               // a /status.bin is out
+};
+
+struct request {
+  std::shared_ptr<shim_conn> c;
+  uint64_t at;
+  int kind;
+  browser *b;
+};
+
+static std::vector<request> out;
+static uint64_t rate, rtt;
+static uint64_t bytes = 0;
+static int failed = 0;
+static std::vector<uint32_t> loads, reads, watches, sets, ages;
+
+static void get(browser *b, int kind, const char *uri, bool fast) {
+  auto c = std::make_shared<shim_conn>();
+  c->rate = fast ? 10 * 1000 * 1000 : rate;
+  c->rtt = fast ? 2000 : rtt;
+  shim_headers h = { { "Accept-Encoding", "gzip, deflate" } };
+  server.connect(c, HTTP_GET, uri, h);
+  out.push_back({ c, shim_now(), kind, b });
+}
+
+static void load_page(browser *b) {
+  b->loading = 1;
+  b->started = shim_now();
+  get(b, GET_INDEX, "/", false);
+}
+
+// the browser has the whole reply once the sketch let go of the
+// connection and the last byte has crossed the link
+static void done(const request &r, std::mt19937 &rng) {
+  uint64_t now = std::max(r.c->done_at(), r.at);
+  uint32_t ms = (uint32_t)((now - r.at) / 1000);
+  std::string body;
+  int code = shim_response(r.c->out, &body);
+  bytes += r.c->out.size();
+  if (code != 200) {
+    failed++;
+  }
+  browser *b = r.b;
+  switch (r.kind) {
+  case GET_INDEX:
+    b->loading = 4;
+    get(b, GET_PAGE, "/bootstrap.min.css", false);
+    get(b, GET_PAGE, "/jquery.min.js", false);
+    get(b, GET_PAGE, "/Chart.bundle.min.js", false);
+    get(b, GET_PAGE, "/history?since=0", false);
+    break;
+  case GET_PAGE:
+    if (--b->loading == 0) {
+      loads.push_back((uint32_t)((now - b->started) / 1000));
+      b->next_read = now;
+      b->reload = now + (RELOAD_MIN + rng() % (RELOAD_MAX - RELOAD_MIN + 1)) * 1000000ULL;
+    }
+    break;
+  case GET_STATUS:
+    reads.push_back(ms);
+    b->reading = false;
+    break;
+  case WATCH_STATUS:
+    watches.push_back(ms);
+    if (code == 200 && body.size() == 32) {
+      ages.push_back(get32(body, 28));
+    }
+    break;
+  case WATCH_SET:
+    sets.push_back(ms);
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  int nbrowsers = 4;
+  double kbs = 32;
+  double rtt_ms = 30;
+  uint32_t read_ms = 500;
+  double secs = 120;
+  uint32_t seed = 5005;
+  int opt;
+  psu_init(&psu, from_psu, NULL);
+  psu.load = LOAD_OPEN;
+  while ((opt = getopt(argc, argv, "b:r:R:i:t:s:")) != -1) {
+    switch (opt) {
+    case 'b': nbrowsers = atoi(optarg); break;
+    case 'r': kbs = atof(optarg); break;
+    case 'R': rtt_ms = atof(optarg); break;
+    case 'i': read_ms = strtoul(optarg, NULL, 0); break;
+    case 't': secs = atof(optarg); break;
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    default:
+      fprintf(stderr, "USAGE: wz5005-httpload [-b browsers] [-r KB/s] [-R rtt_ms] [-i read_ms] [-t seconds] [-s seed]\n");
+      return 1;
+    }
+  }
+  if (nbrowsers < 0 || kbs <= 0 || !read_ms || secs <= 0) {
+    fprintf(stderr, "rate, read interval and time must be more than 0\n");
+    return 1;
+  }
+  rate = (uint64_t)(kbs * 1024);
+  rtt = (uint64_t)(rtt_ms * 1000);
+  std::mt19937 rng(seed);
+  psu.rng.seed(seed);
+
+  Serial1.tx = to_psu;
+  shim_fs_load(FW "/data");
+  setup();
+  for (int i = 0; i < 1000; i++) {
+    loop();
+    shim_advance(STEP_US);
+  }
+
+  std::vector<browser> browsers(nbrowsers);
+  uint64_t start = shim_now();
+  uint64_t end = start + (uint64_t)(secs * 1e6);
+  // not all at once, a browser turns up every couple of hundred ms
+  for (int i = 0; i < nbrowsers; i++) {
+    browsers[i] = {};
+    browsers[i].reload = start + i * 250000ULL;
+    browsers[i].next_read = (uint64_t)-1;
+  }
+  uint64_t next_watch = start, next_set = start + 500000ULL;
+  uint32_t worst_loop = 0;
+
+  while (shim_now() < end) {
+    uint64_t now = shim_now();
+    for (browser &b : browsers) {
+      if (!b.loading && now >= b.reload) {
+        b.reading = false;
+        b.next_read = (uint64_t)-1;
+        load_page(&b);
+      } else if (!b.loading && !b.reading && now >= b.next_read) {
+        b.next_read += read_ms * 1000ULL;
+        b.reading = true;
+        get(&b, GET_STATUS, "/status.bin", false);
+      }
+    }
+    if (now >= next_watch) {
+      next_watch += (WATCH_MS - 10 + rng() % 21) * 1000ULL; // not in step with the poller
+      get(NULL, WATCH_STATUS, "/status.bin", true);
+    }
+    if (now >= next_set) {
+      next_set += SET_MS * 1000ULL;
+      char uri[32];
+      snprintf(uri, sizeof(uri), "/uset?v=%u", (unsigned)(rng() % 4999));
+      get(NULL, WATCH_SET, uri, true);
+    }
+
+    uint64_t t = shim_now();
+    loop();
+    worst_loop = std::max(worst_loop, (uint32_t)((shim_now() - t) / 1000));
+    shim_advance(STEP_US);
+
+    for (size_t i = 0; i < out.size(); ) {
+      request r = out[i];
+      if (r.c->open || shim_now() < r.c->done_at()) {
+        i++;
+        continue;
+      }
+      out.erase(out.begin() + i);
+      done(r, rng);
+    }
+  }
+
+  double span = (shim_now() - start) / 1e6;
+  printf("%d browsers at %.0f KB/s rtt %.0f ms, %.0f s, %d downloads fed from loop()\n",
+         nbrowsers, kbs, rtt_ms, span, DOWNLOADS_MAX);
+  percentiles("page load", loads);
+  percentiles("their reads", reads);
+  percentiles("watch read", watches);
+  percentiles("watch set", sets);
+  percentiles("status age", ages);
+  printf("%.1f KB/s to all browsers, longest loop() %u ms, %d not 200, %zu still open\n",
+         bytes / 1024.0 / span, worst_loop, failed, out.size());
+  return 0;
+}
@@ -0,0 +1,211 @@
+// wz5005-modbusd - the sketch's modbus-tcp gateway on linux, for a supply
+// on a usb serial adapter instead of behind the esp. the poller and the
+// register map are the sketch's own (dps.cpp and modbus.cpp built against
+// shim/), the virtual clock just follows the real one here. point it at
+// the sim to try masters without the supply:
+//
+//   ./wz5005-sim -l /tmp/tty63 &
+//   ./wz5005-modbusd [-p port] [-v] /tmp/tty63
+//
+//   -p port   tcp port to listen on (default 1502, 502 needs root)
+//   -v        hex dump requests and replies to stderr
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include "Arduino.h"
+#include "shim.hpp"
+#include "dps.hpp"
+#include "modbus.hpp"
+
+#define MASTERS 32          // connected at once, the esp only has room for MODBUS_CLIENTS
+
+struct master {
+  int fd;
+  uint8_t buf[MODBUS_FRAME];
+  size_t have;
+  uint32_t seen;            // millis() of the last byte
+  bool ready;               // poll() says there is something to read
+};
+
+static bool verbose = false;
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int) {
+  quit = 1;
+}
+
+static long long now_us(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void to_tty(void *ctx, const uint8_t *p, size_t n) {
+  int fd = *(int *)ctx;
+  while (n) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0 && errno != EAGAIN) return;
+    if (w > 0) {
+      p += w;
+      n -= w;
+    }
+  }
+}
+
+static void dump(const char *what, int fd, const uint8_t *p, size_t n) {
+  if (!verbose) return;
+  fprintf(stderr, "%s %d:", what, fd);
+  for (size_t i = 0; i < n; i++) fprintf(stderr, " %02x", p[i]);
+  fprintf(stderr, "\n");
+}
+
+static int listen_on(uint16_t port) {
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  int on = 1, off = 0;
+  if (fd < 0) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  struct sockaddr_in6 sa = {};
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(port);
+  sa.sin6_addr = in6addr_any;
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 8)) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+// false once the master should be dropped
+static bool serve(master *m) {
+  ssize_t got = read(m->fd, m->buf + m->have, sizeof(m->buf) - m->have);
+  if (got == 0 || (got < 0 && errno != EAGAIN)) {
+    return false;
+  }
+  if (got > 0) {
+    m->have += got;
+    m->seen = millis();
+  }
+  uint8_t reply[MODBUS_FRAME];
+  int len;
+  while ((len = modbus_length(m->buf, m->have)) > 0 && (size_t)len <= m->have) {
+    size_t n = modbus_frame(m->buf, len, reply);
+    dump("<", m->fd, m->buf, len);
+    dump(">", m->fd, reply, n);
+    // a reply is a couple of dozen bytes, if the socket cant take that
+    // the master isnt reading them
+    if (send(m->fd, reply, n, MSG_NOSIGNAL) != (ssize_t)n) {
+      return false;
+    }
+    memmove(m->buf, m->buf + len, m->have - len);
+    m->have -= len;
+  }
+  return len >= 0;
+}
+
+int main(int argc, char **argv) {
+  uint16_t port = 1502;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:v")) != -1) {
+    switch (opt) {
+    case 'p': port = (uint16_t)strtoul(optarg, NULL, 0); break;
+    case 'v': verbose = true; break;
+    default: optind = argc + 1; break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "USAGE: wz5005-modbusd [-p port] [-v] tty\n");
+    return 1;
+  }
+
+  int tty = open(argv[optind], O_RDWR | O_NOCTTY | O_NONBLOCK);
+  struct termios tio;
+  if (tty < 0 || tcgetattr(tty, &tio)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B9600);
+  tcsetattr(tty, TCSANOW, &tio);
+
+  int lfd = listen_on(port);
+  if (lfd < 0) {
+    perror("listen");
+    return 1;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  Serial1.tx = to_tty;
+  Serial1.txctx = &tty;
+  // same as setup(), the supply only takes sets in remote mode
+  dps_set_mode(true);
+
+  std::vector<master *> masters;
+  long long start = now_us();
+  fprintf(stderr, "modbus-tcp on port %u for %s\n", port, argv[optind]);
+  while (!quit) {
+    std::vector<struct pollfd> pfd;
+    pfd.push_back({ tty, POLLIN, 0 });
+    pfd.push_back({ lfd, POLLIN, 0 });
+    for (master *m : masters) pfd.push_back({ m->fd, POLLIN, 0 });
+    // dps_tick() wants a look every ms or so for its timeouts
+    poll(pfd.data(), pfd.size(), 1);
+    for (size_t i = 0; i < masters.size(); i++) {
+      masters[i]->ready = pfd[i + 2].revents != 0;
+    }
+    uint64_t t = now_us() - start;
+    if (t > shim_now()) {
+      shim_advance(t - shim_now());
+    }
+
+    uint8_t in[256];
+    ssize_t n;
+    while ((n = read(tty, in, sizeof(in))) > 0) {
+      Serial.rx.insert(Serial.rx.end(), in, in + n);
+    }
+    dps_tick();
+
+    int fd = accept(lfd, NULL, NULL);
+    if (fd >= 0 && masters.size() >= MASTERS) {
+      close(fd);
+    } else if (fd >= 0) {
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      master *m = new master();
+      m->fd = fd;
+      m->seen = millis();
+      masters.push_back(m);
+    }
+    for (size_t i = 0; i < masters.size(); ) {
+      master *m = masters[i];
+      if (m->ready ? serve(m) : millis() - m->seen <= MODBUS_IDLE) {
+        i++;
+        continue;
+      }
+      close(m->fd);
+      delete m;
+      masters.erase(masters.begin() + i);
+    }
+  }
+  for (master *m : masters) {
+    close(m->fd);
+    delete m;
+  }
+  close(lfd);
+  close(tty);
+  return 0;
+}
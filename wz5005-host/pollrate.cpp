@@ -0,0 +1,153 @@
+// wz5005-pollrate - how many full status refreshes (0x23 + 0x29 + 0x2B)
+// a second the serial link manages, asking one query at a time versus
+// sending the round back to back the way dps_tick does with DPS_PIPELINE.
+// Requests are paced out at 9600 baud here, run the sim with -b so the
+// replies are too
+//
+//   ./wz5005-pollrate [-n rounds] [-p depth] [-t timeout_ms] [-a addr] tty
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include "wz5005.hpp"
+
+using namespace wz5005;
+
+#define BYTE_US 1042        // 10 bits at 9600 baud
+
+static const uint8_t queries[] = { GET_STATUS, GET_OUTPUT, GET_SETPOINTS };
+
+static int timeout_ms = 100;
+static uint8_t addr = DEFAULT_ADDR;
+
+static long long now_us(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void send_paced(int fd, const Buffer &buf) {
+  for (size_t i = 0; i < FRAME_LEN; i++) {
+    if (write(fd, &buf[i], 1) != 1) return;
+    usleep(BYTE_US);
+  }
+}
+
+struct pending {
+  uint8_t cmd;
+  long long sentat;
+};
+
+// queries in flight, matched by command byte as they come back
+static pending inflight[sizeof(queries)];
+static int ninflight;
+static Buffer rxbuf;
+static size_t rxpos;
+
+static void complete(uint8_t cmd) {
+  for (size_t i = 0; i < sizeof(queries); i++) {
+    if (inflight[i].cmd == cmd) {
+      inflight[i].cmd = 0;
+      ninflight--;
+      return;
+    }
+  }
+}
+
+// read until nothing is outstanding, dropping queries that time out
+static int drain(int fd) {
+  int missed = 0;
+  while (ninflight) {
+    long long t = now_us();
+    long long oldest = t;
+    for (size_t i = 0; i < sizeof(queries); i++) {
+      if (!inflight[i].cmd) continue;
+      if (t - inflight[i].sentat >= timeout_ms * 1000LL) {
+        inflight[i].cmd = 0;
+        ninflight--;
+        missed++;
+      } else if (inflight[i].sentat < oldest) {
+        oldest = inflight[i].sentat;
+      }
+    }
+    if (!ninflight) break;
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int wait = (int)((oldest + timeout_ms * 1000LL - t) / 1000) + 1;
+    if (poll(&pfd, 1, wait) <= 0) continue;
+    uint8_t c;
+    while (read(fd, &c, 1) == 1) {
+      if (rxpos == 0 && c != HEADER) continue;
+      rxbuf[rxpos++] = c;
+      if (rxpos < FRAME_LEN) continue;
+      rxpos = 0;
+      Frame f;
+      if (Frame::decode(rxbuf, f) == Error::OK && f.addr == addr) {
+        complete(f.cmd);
+      }
+    }
+  }
+  return missed;
+}
+
+static void run(int fd, int rounds, size_t depth) {
+  int missed = 0;
+  rxpos = 0;
+  tcflush(fd, TCIOFLUSH);
+  long long start = now_us();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t q = 0; q < sizeof(queries); ) {
+      for (size_t n = 0; n < depth && q < sizeof(queries); n++, q++) {
+        inflight[n].cmd = queries[q];
+        inflight[n].sentat = now_us();
+        ninflight++;
+        send_paced(fd, frame(queries[q], queries[q] == GET_STATUS ? 0x01 : 0x00, addr));
+      }
+      missed += drain(fd);
+    }
+  }
+  double secs = (now_us() - start) / 1e6;
+  printf("depth %zu: %d rounds in %.2fs, %.1f ms/round, %.2f refreshes/s, %d replies missed\n",
+         depth, rounds, secs, secs * 1000 / rounds, rounds / secs, missed);
+}
+
+int main(int argc, char **argv) {
+  int rounds = 50;
+  size_t depth = sizeof(queries);
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:t:a:")) != -1) {
+    switch (opt) {
+    case 'n': rounds = atoi(optarg); break;
+    case 'p': depth = strtoul(optarg, NULL, 0); break;
+    case 't': timeout_ms = atoi(optarg); break;
+    case 'a': addr = (uint8_t)strtoul(optarg, NULL, 0); break;
+    default: rounds = 0; break;
+    }
+  }
+  if (optind != argc - 1 || rounds <= 0 || depth < 1 || depth > sizeof(queries)) {
+    fprintf(stderr, "USAGE: wz5005-pollrate [-n rounds] [-p depth] [-t timeout_ms] [-a addr] tty\n");
+    return 1;
+  }
+
+  int fd = open(argv[optind], O_RDWR | O_NOCTTY | O_NONBLOCK);
+  struct termios tio;
+  if (fd < 0 || tcgetattr(fd, &tio)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B9600);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  // before and after, same link same run
+  run(fd, rounds, 1);
+  if (depth > 1) {
+    run(fd, rounds, depth);
+  }
+  close(fd);
+  return 0;
+}
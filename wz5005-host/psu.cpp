@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psu.hpp"
+
+using namespace wz5005;
+
+void psu_init(psu *p, void (*emit)(void *ctx, const uint8_t *p, size_t n), void *ctx) {
+  p->addr = DEFAULT_ADDR;
+  p->remote = false;
+  p->on = false;
+  p->abnormal = 0;
+  p->setp = { 0x1388, 0x12AB, 500, 1000, {0x00, 0x00, 0x00, 0x42, 0x00, 0x00, 0x00, 0x00} };
+  p->load = LOAD_RES;
+  p->load_val = 10.0;
+  p->badreply = p->badrequest = p->dropbyte = 0;
+  p->rng.seed(5005);
+  p->verbose = false;
+  p->pos = 0;
+  p->emit = emit;
+  p->ctx = ctx;
+}
+
+static bool chance(psu *p, double rate) {
+  return rate > 0 && std::uniform_real_distribution<double>(0, 1)(p->rng) < rate;
+}
+
+static void dump(psu *p, const char *dir, const uint8_t *b, size_t n) {
+  if (!p->verbose) return;
+  fprintf(stderr, "%s", dir);
+  for (size_t i = 0; i < n; i++) fprintf(stderr, " %02x", b[i]);
+  fprintf(stderr, "\n");
+}
+
+// work out where on the load line we sit. uset is 10mV units, iset mA
+void psu_output(psu *p, uint16_t *uout, uint16_t *iout, bool *cc) {
+  *uout = 0;
+  *iout = 0;
+  *cc = false;
+  if (!p->on) return;
+
+  double v = p->setp.uset / 100.0;
+  double ilim = p->setp.iset / 1000.0;
+  double i;
+  switch (p->load) {
+  case LOAD_OPEN:  i = 0; break;
+  case LOAD_SHORT: i = ilim + 1; break;
+  case LOAD_RES:   i = v / p->load_val; break;
+  default:         i = p->load_val; break;
+  }
+  if (i > ilim) {
+    // cc, voltage sags until the load takes exactly ilim
+    *cc = true;
+    i = ilim;
+    v = p->load == LOAD_RES ? ilim * p->load_val : 0;
+  }
+  *uout = (uint16_t)(v * 100 + 0.5);
+  *iout = (uint16_t)(i * 1000 + 0.5);
+
+  // protection trips turn the output off like the real thing
+  if (*uout > p->setp.ovp) p->abnormal = 1;
+  else if (*iout > p->setp.ocp) p->abnormal = 2;
+  if (p->abnormal) p->on = false;
+}
+
+static void send_reply(psu *p, Buffer &buf) {
+  if (chance(p, p->badreply)) buf[FRAME_LEN - 1] ^= 0x5A;
+  dump(p, "<", buf.data(), buf.size());
+  uint8_t out[FRAME_LEN];
+  size_t n = 0;
+  for (size_t i = 0; i < FRAME_LEN; i++) {
+    if (!chance(p, p->dropbyte)) out[n++] = buf[i];
+  }
+  p->emit(p->ctx, out, n);
+}
+
+static void ack(psu *p, uint8_t code) {
+  Buffer out;
+  encode(Ack{ code }, out, p->addr);
+  send_reply(p, out);
+}
+
+static void handle(psu *p, const Buffer &in) {
+  Frame f;
+  Buffer out;
+  if (Frame::decode(in, f) != Error::OK || chance(p, p->badrequest)) {
+    ack(p, BADTXCHKSM);
+    return;
+  }
+  if (f.addr != p->addr) {
+    return; // somebody else on the bus
+  }
+
+  uint16_t uout, iout;
+  bool cc;
+  psu_output(p, &uout, &iout, &cc);
+
+  switch (f.cmd) {
+  case SET_MODE:
+    p->remote = f.args[0] != 0;
+    ack(p, ELSEHRM);
+    break;
+  case SET_ADDRESS:
+    ack(p, ELSEHRM);
+    p->addr = f.args[0];
+    break;
+  case SET_OUTPUT:
+    p->on = f.args[0] != 0;
+    if (p->on) p->abnormal = 0;
+    ack(p, ELSEHRM);
+    break;
+  case GET_STATUS:
+    encode(Status{ p->on, cc, p->abnormal }, out, p->addr);
+    send_reply(p, out);
+    break;
+  case GET_INFO:
+    encode(Info{ 0x05, 0x0100, 5005 }, out, p->addr);
+    send_reply(p, out);
+    break;
+  case GET_OUTPUT:
+    encode(Output{ uout, iout }, out, p->addr);
+    send_reply(p, out);
+    break;
+  case GET_STATS: {
+    Stats st = {};
+    encode(st, out, p->addr);
+    send_reply(p, out);
+    break;
+  }
+  case GET_SETPOINTS: {
+    Setpoints sp;
+    Frame tmp = {};
+    p->setp.to(tmp);
+    sp.from(tmp);
+    encode(sp, out, p->addr);
+    send_reply(p, out);
+    break;
+  }
+  case SET_SETPOINTS: {
+    SetSetpoints sp;
+    sp.from(f);
+    if (sp.uset > MAX_VOLTAGE || sp.iset > MAX_CURRENT) {
+      ack(p, BADCMNDOROVRFLW);
+      break;
+    }
+    p->setp = sp;
+    ack(p, ELSEHRM);
+    break;
+  }
+  default:
+    ack(p, UNKNOWNCMD);
+    break;
+  }
+}
+
+bool psu_parse_load(psu *p, const char *arg) {
+  if (!strcmp(arg, "open")) {
+    p->load = LOAD_OPEN;
+  } else if (!strcmp(arg, "short")) {
+    p->load = LOAD_SHORT;
+  } else if (!strncmp(arg, "r:", 2) && atof(arg + 2) > 0) {
+    p->load = LOAD_RES;
+    p->load_val = atof(arg + 2);
+  } else if (!strncmp(arg, "cc:", 3)) {
+    p->load = LOAD_CC;
+    p->load_val = atof(arg + 3);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// one byte off the wire, hunting for the header the same way the supply
+// does. a frame that isnt finished is kept until psu_rx_reset()
+void psu_feed(psu *p, uint8_t c) {
+  if (p->pos == 0 && c != HEADER) return;
+  p->in[p->pos++] = c;
+  if (p->pos < FRAME_LEN) return;
+  p->pos = 0;
+  dump(p, ">", p->in.data(), p->in.size());
+  handle(p, p->in);
+}
+
+void psu_rx_reset(psu *p) {
+  p->pos = 0;
+}
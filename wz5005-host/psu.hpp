@@ -0,0 +1,41 @@
+#ifndef __PSU__
+#define __PSU__
+
+// a pretend wz5005, the part of wz5005-sim that isnt the pty. wz5005-fw
+// wires the same thing to the shimmed uart so the firmware talks to it
+// directly. feed it request bytes, replies come out thru emit
+
+#include <stdint.h>
+#include <random>
+#include "dps.hpp"
+
+enum load_kind { LOAD_OPEN, LOAD_SHORT, LOAD_RES, LOAD_CC };
+
+struct psu {
+  uint8_t addr;
+  bool remote;
+  bool on;
+  uint8_t abnormal;
+  wz5005::SetSetpoints setp;
+  load_kind load;
+  double load_val;          // ohms or amps
+
+  double badreply;          // chance a reply goes out with a broken checksum
+  double badrequest;        // chance a good request is treated as a bad checksum
+  double dropbyte;          // chance any single reply byte is dropped
+  std::mt19937 rng;
+  bool verbose;             // hex dump traffic to stderr
+
+  wz5005::Buffer in;
+  size_t pos;
+  void (*emit)(void *ctx, const uint8_t *p, size_t n);
+  void *ctx;
+};
+
+void psu_init(psu *p, void (*emit)(void *ctx, const uint8_t *p, size_t n), void *ctx);
+bool psu_parse_load(psu *p, const char *arg);
+void psu_output(psu *p, uint16_t *uout, uint16_t *iout, bool *cc);
+void psu_feed(psu *p, uint8_t c);
+void psu_rx_reset(psu *p);
+
+#endif
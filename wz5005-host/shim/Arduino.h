@@ -0,0 +1,98 @@
+#ifndef __SHIM_ARDUINO__
+#define __SHIM_ARDUINO__
+
+// host stand ins for the bits of the arduino / esp8266 core the sketch
+// uses, so it builds and runs on linux (wz5005-fw). time only moves when
+// delay() is called or the harness says so, see shim.hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include "WString.h"
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+#define IRAM_ATTR
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+// bytes written go to tx(), bytes the harness pushes into rx come back
+// out of read(). the sketch prints debug on Serial and talks to the
+// supplies on Serial1 tx / Serial rx, wz5005-fw connects those up
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) { baud_ = baud; }
+  unsigned long baud() const { return baud_; }
+  int available(void) { return (int)rx.size(); }
+  int read(void) {
+    if (rx.empty()) return -1;
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *p, size_t n) {
+    if (tx) tx(txctx, p, n);
+    return n;
+  }
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  void flush(void) {}
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long v, int base = DEC);
+  size_t print(unsigned long v, int base = DEC);
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  template <typename T>
+  size_t println(const T &v) { size_t n = print(v); return n + write("\r\n"); }
+  template <typename T>
+  size_t println(const T &v, int base) { size_t n = print(v, base); return n + write("\r\n"); }
+  size_t println(void) { return write("\r\n"); }
+
+  std::deque<uint8_t> rx;
+  void (*tx)(void *ctx, const uint8_t *p, size_t n) = NULL;
+  void *txctx = NULL;
+
+private:
+  unsigned long baud_ = 0;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+// the heap as the sketch sees it. SHIM_HEAP is what is left once wifi,
+// the core and the sketch's statics have theirs, live Strings take from
+// that. nothing here fragments, so the biggest free block is all of it.
+// the cycle counter runs at SHIM_MHZ on the virtual clock plus the real
+// time spent since the start, so a handler (which takes no virtual time)
+// shows what it costs on this machine and a uart reply what it waited
+#define SHIM_HEAP 40000
+#define SHIM_MHZ 80
+
+class EspClass {
+public:
+  uint32_t getCycleCount(void);
+  uint8_t getCpuFreqMHz(void) { return SHIM_MHZ; }
+  uint32_t getFreeHeap(void) { return SHIM_HEAP - (uint32_t)shim_string_bytes; }
+  uint32_t getMaxFreeBlockSize(void) { return getFreeHeap(); }
+  uint8_t getHeapFragmentation(void) { return 0; }
+};
+
+extern EspClass ESP;
+
+#endif
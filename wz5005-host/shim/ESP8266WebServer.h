@@ -0,0 +1,152 @@
+#ifndef __SHIM_ESP8266WEBSERVER__
+#define __SHIM_ESP8266WEBSERVER__
+
+// the request side of ESP8266WebServer without the network. routes are
+// registered the usual way, the harness then calls request() and gets
+// back the status and body the handler produced, all in process. or it
+// queues requests with connect() and they get handled one per
+// handleClient() call from the sketch's loop(), like the real one does
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "FS.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+#define HTTP_UPLOAD_BUFLEN 2048
+#define SHIM_TCP_PCBS 5             // lwip's MEMP_NUM_TCP_PCB, connections open at once
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+typedef std::vector<std::pair<std::string, std::string>> shim_headers;
+
+class ESP8266WebServer {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  ESP8266WebServer(int port = 80) { (void)port; }
+  void begin(void) {}
+  void handleClient(void);
+  void close(void) {}
+
+  void on(const String &uri, THandlerFunction fn) { on(uri, HTTP_ANY, fn, NULL); }
+  void on(const String &uri, HTTPMethod method, THandlerFunction fn) { on(uri, method, fn, NULL); }
+  void on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn) {
+    routes_.push_back({ uri.str(), method, fn, ufn });
+  }
+  void onNotFound(THandlerFunction fn) { notfound_ = fn; }
+
+  // the core hands these out by reference to the Strings it parsed the
+  // request into, asking for one doesnt make a String
+  const String &uri(void) { return uri_; }
+  HTTPMethod method(void) { return method_; }
+  const String &arg(const String &name);
+  bool hasArg(const String &name);
+  int args(void) { return (int)args_.size(); }
+  const String &arg(int i) { return argv_[i]; }
+  String argName(int i) { return String(args_[i].first); }
+  const String &header(const String &name);
+  bool hasHeader(const String &name);
+  void collectHeaders(const char *headers[], size_t n) { (void)headers; (void)n; }
+
+  WiFiClient client(void) { return client_; }
+  HTTPUpload &upload(void) { return upload_; }
+
+  void setContentLength(size_t len) { length_ = len; }
+  void sendHeader(const String &name, const String &value, bool first = false);
+  void send(int code, const char *type = NULL, const String &content = String());
+  void send(int code, const String &type, const String &content) { send(code, type.c_str(), content); }
+  void send(int code, const char *type, const char *content) {
+    send(code, type, (const uint8_t *)content, strlen(content));
+  }
+  void send(int code, const char *type, const uint8_t *content, size_t len);
+  void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char *content) { sendContent(content, strlen(content)); }
+  void sendContent(const char *content, size_t len);
+  size_t streamFile(File &file, const String &type);
+
+  // harness side. runs the handler for one request and returns the status
+  // on the status line, 0 if nothing was written. body gets what came
+  // after the headers, chunked bodies put back together. a handler that
+  // left the body to a download (see downloads.hpp) has only sent the
+  // headers by the time this returns, last_conn() gets the rest
+  int request(HTTPMethod method, const char *uri, std::string *body = NULL,
+              const shim_headers &headers = shim_headers(), shim_headers *reply = NULL);
+  // a multipart upload the way the real server feeds it to the upload
+  // handler, in HTTP_UPLOAD_BUFLEN pieces, then the route handler
+  int upload(const char *uri, const char *filename, const uint8_t *data, size_t len, std::string *body = NULL);
+  // queue a request on conn (rate/rtt set up as wanted), the next
+  // handleClient() with nothing queued ahead of it runs the handler, once
+  // fewer than SHIM_TCP_PCBS of the ones before it are still open
+  void connect(std::shared_ptr<shim_conn> conn, HTTPMethod method, const char *uri,
+               const shim_headers &headers = shim_headers());
+  int waiting(void) const { return (int)queue_.size(); }
+  // the connection of the last request, to keep reading what a streaming
+  // handler writes after it returned
+  std::shared_ptr<shim_conn> last_conn(void) { return last_; }
+
+private:
+  struct route {
+    std::string uri;
+    HTTPMethod method;
+    THandlerFunction fn;
+    THandlerFunction ufn;
+  };
+
+  struct pending {
+    std::shared_ptr<shim_conn> conn;
+    HTTPMethod method;
+    std::string uri;
+    shim_headers headers;
+  };
+
+  const route *find(HTTPMethod method);
+  void begin_request(HTTPMethod method, const char *uri, const shim_headers &headers,
+                     std::shared_ptr<shim_conn> conn);
+  void handle(void);
+  int finish_request(std::string *body, shim_headers *reply);
+
+  std::vector<route> routes_;
+  THandlerFunction notfound_;
+  std::deque<pending> queue_;
+  std::vector<std::shared_ptr<shim_conn>> pcbs_;
+  std::shared_ptr<shim_conn> last_;
+
+  HTTPMethod method_ = HTTP_GET;
+  std::string path_;
+  String uri_;
+  shim_headers args_;
+  std::vector<String> argv_;
+  shim_headers headers_;
+  std::vector<String> headerv_;
+  WiFiClient client_;
+  HTTPUpload upload_;
+
+  shim_headers out_headers_;
+  size_t length_ = CONTENT_LENGTH_NOT_SET;
+  bool chunked_ = false;
+};
+
+// status, headers and body (chunks put back together) out of the raw
+// bytes of a response, 0 when there isnt a whole status line and headers
+int shim_response(const std::string &raw, std::string *body = NULL, shim_headers *reply = NULL);
+
+#endif
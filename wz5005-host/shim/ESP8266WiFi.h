@@ -0,0 +1,129 @@
+#ifndef __SHIM_ESP8266WIFI__
+#define __SHIM_ESP8266WIFI__
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+
+class ESP8266WiFiClass {
+public:
+  int begin(const char *, const char *) { return WL_CONNECTED; }
+  int status(void) { return WL_CONNECTED; }
+  String localIP(void) { return String("127.0.0.1"); }
+  int32_t RSSI(void) { return -60; }
+};
+
+extern ESP8266WiFiClass WiFi;
+
+// one tcp connection. copies share it like the real WiFiClient, so a
+// handler that keeps server.client() for later (the /events listeners,
+// downloads) holds the same connection the request came in on, and it
+// closes when the last copy in the sketch goes. everything written piles
+// up in out for the harness to look at
+//
+// with rate set the browser end is modelled too: written bytes leave one
+// after the other at rate bytes/s, are acked an rtt after they are gone
+// and only sndbuf unacked bytes fit, like lwip's TCP_SND_BUF. write()
+// then blocks (on the virtual clock) until they fit, as the core's does
+struct shim_conn {
+  std::string out;
+  std::string in;             // what the other end sent, for read()
+  bool open = true;
+  bool nodelay = false;
+  size_t limit = (size_t)-1;  // writes past this many bytes in out fail, a stalled reader
+  int refs = 0;               // WiFiClients in the sketch holding it
+
+  uint64_t rate = 0;          // bytes/s, 0 = instant with no send buffer limit
+  uint64_t rtt = 0;           // us
+  size_t sndbuf = 2920;       // 2 * TCP_MSS
+  uint64_t free_at = 0;       // when the last byte queued is on its way
+  std::deque<std::pair<uint64_t, size_t>> unacked;  // acked at, bytes
+
+  size_t room(void);
+  size_t queue(const uint8_t *p, size_t n);
+  // closed and everything acked, lwip has its pcb back
+  bool gone(void) const;
+  // when the browser has all of it, the last byte in plus half an rtt
+  uint64_t done_at(void) const { return free_at + rtt / 2; }
+};
+
+#define WIFICLIENT_TIMEOUT 5000   // ms a blocked write() waits, WiFiClient's default
+
+class WiFiClient {
+public:
+  WiFiClient() {}
+  WiFiClient(std::shared_ptr<shim_conn> c) : c_(c) { ref(); }
+  WiFiClient(const WiFiClient &o) : c_(o.c_) { ref(); }
+  WiFiClient &operator=(const WiFiClient &o) {
+    if (this != &o) {
+      unref();
+      c_ = o.c_;
+      ref();
+    }
+    return *this;
+  }
+  ~WiFiClient() { unref(); }
+
+  uint8_t connected(void) { return c_ && c_->open; }
+  explicit operator bool() { return connected(); }
+  size_t write(const uint8_t *p, size_t n);
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t availableForWrite(void) { return connected() ? c_->room() : 0; }
+  void setNoDelay(bool on) { if (c_) c_->nodelay = on; }
+  bool stop(unsigned int maxWaitMs = 0) {
+    (void)maxWaitMs;
+    if (c_) c_->open = false;
+    return true;
+  }
+  void flush(void) {}
+  int available(void) { return c_ ? (int)c_->in.size() : 0; }
+  int read(void) {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int read(uint8_t *p, size_t n) {
+    if (!c_) return -1;
+    n = std::min(n, c_->in.size());
+    memcpy(p, c_->in.data(), n);
+    c_->in.erase(0, n);
+    return (int)n;
+  }
+
+  std::shared_ptr<shim_conn> conn(void) const { return c_; }
+
+private:
+  void ref(void) { if (c_) c_->refs++; }
+  void unref(void) {
+    if (c_ && --c_->refs == 0) c_->open = false;
+    c_.reset();
+  }
+
+  std::shared_ptr<shim_conn> c_;
+};
+
+// a listening socket. accept() hands out the connections the harness
+// made with shim_tcp_connect() to its port, oldest first
+class WiFiServer {
+public:
+  WiFiServer(uint16_t port) : port_(port) {}
+  ~WiFiServer();
+  void begin(void);
+  void setNoDelay(bool on) { nodelay_ = on; }
+  WiFiClient accept(void);
+
+private:
+  friend bool shim_tcp_connect(uint16_t port, std::shared_ptr<shim_conn> conn);
+  uint16_t port_;
+  bool nodelay_ = false;
+  std::deque<std::shared_ptr<shim_conn>> backlog_;
+};
+
+// harness side, a client connecting to whatever WiFiServer began on port.
+// false when nothing is listening there
+bool shim_tcp_connect(uint16_t port, std::shared_ptr<shim_conn> conn);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __SHIM_ESP8266MDNS__
+#define __SHIM_ESP8266MDNS__
+
+class MDNSResponder {
+public:
+  bool begin(const char *) { return true; }
+  void addService(const char *, const char *, int) {}
+  void update(void) {}
+};
+
+extern MDNSResponder MDNS;
+
+#endif
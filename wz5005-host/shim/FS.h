@@ -0,0 +1,99 @@
+#ifndef __SHIM_FS__
+#define __SHIM_FS__
+
+// SPIFFS kept in memory, so runs dont leave anything behind and start the
+// same every time. shim_fs_load() copies a directory (data/) in
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+typedef std::shared_ptr<std::vector<uint8_t>> shim_blob;
+
+enum SeekMode { SeekSet, SeekCur, SeekEnd };
+
+// bytes read out of "flash" so far, for the harness
+extern uint64_t shim_fs_read_bytes;
+
+class File {
+public:
+  File() {}
+  File(const std::string &name, shim_blob data, size_t pos) : name_(name), data_(data), pos_(pos) {}
+  explicit operator bool() const { return (bool)data_; }
+  size_t size() const { return data_ ? data_->size() : 0; }
+  size_t position() const { return pos_; }
+  int available() const { return data_ ? (int)(data_->size() - pos_) : 0; }
+  const char *name() const { return name_.c_str(); }
+  int read(void) {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int read(uint8_t *buf, size_t n) {
+    if (!data_) return -1;
+    size_t left = data_->size() - pos_;
+    if (n > left) n = left;
+    memcpy(buf, data_->data() + pos_, n);
+    pos_ += n;
+    shim_fs_read_bytes += n;
+    return (int)n;
+  }
+  size_t write(const uint8_t *buf, size_t n) {
+    if (!data_) return 0;
+    if (pos_ + n > data_->size()) data_->resize(pos_ + n);
+    memcpy(data_->data() + pos_, buf, n);
+    pos_ += n;
+    return n;
+  }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  bool seek(size_t pos, SeekMode mode = SeekSet) {
+    if (!data_) return false;
+    if (mode == SeekCur) pos += pos_;
+    else if (mode == SeekEnd) pos = data_->size() - pos;
+    if (pos > data_->size()) return false;
+    pos_ = pos;
+    return true;
+  }
+  void close(void) { data_.reset(); }
+
+private:
+  std::string name_;
+  shim_blob data_;
+  size_t pos_ = 0;
+};
+
+class Dir {
+public:
+  Dir() {}
+  Dir(std::vector<std::pair<std::string, size_t>> e) : entries_(e) {}
+  bool next(void) { return ++at_ < (int)entries_.size(); }
+  String fileName(void) const { return String(entries_[at_].first); }
+  size_t fileSize(void) const { return entries_[at_].second; }
+
+private:
+  std::vector<std::pair<std::string, size_t>> entries_;
+  int at_ = -1;
+};
+
+class FS {
+public:
+  bool begin(void) { return true; }
+  bool exists(const char *path) { return files_.count(path) != 0; }
+  bool exists(const String &path) { return exists(path.c_str()); }
+  File open(const char *path, const char *mode);
+  File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+  bool remove(const char *path) { return files_.erase(path) != 0; }
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to);
+  bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+  Dir openDir(const char *path);
+  Dir openDir(const String &path) { return openDir(path.c_str()); }
+
+private:
+  std::map<std::string, shim_blob> files_;
+};
+
+extern FS SPIFFS;
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef __SHIM_WSTRING__
+#define __SHIM_WSTRING__
+
+// just enough of the arduino String for the sketch, on top of std::string
+
+#include <string>
+#include <string.h>
+
+// the real one keeps up to 11 chars inside itself and mallocs exactly
+// enough for anything longer, again each time it grows past that.
+// shim_string_allocs counts those mallocs and shim_string_bytes is what
+// live Strings hold right now (ESP.getFreeHeap() takes it off)
+#define SHIM_STRING_SSO 11
+extern unsigned long shim_string_allocs;
+extern long shim_string_bytes;
+
+class String {
+public:
+  String() {}
+  String(const char *s) : s_(s ? s : "") { grow(); }
+  String(const std::string &s) : s_(s) { grow(); }
+  String(int v) : s_(std::to_string(v)) { grow(); }
+  String(unsigned int v) : s_(std::to_string(v)) { grow(); }
+  String(long v) : s_(std::to_string(v)) { grow(); }
+  String(unsigned long v) : s_(std::to_string(v)) { grow(); }
+  String(const String &x) : s_(x.s_) { grow(); }
+  String(String &&x) : s_(std::move(x.s_)), cap_(x.cap_) { x.s_.clear(); x.cap_ = 0; }
+  ~String() { shim_string_bytes -= cap_ ? cap_ + 1 : 0; }
+  String &operator=(const String &x) { s_ = x.s_; grow(); return *this; }
+  String &operator=(String &&x) {
+    std::swap(s_, x.s_);
+    std::swap(cap_, x.cap_);
+    return *this;
+  }
+
+  const char *c_str() const { return s_.c_str(); }
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  int toInt() const { return atoi(s_.c_str()); }
+  bool startsWith(const String &x) const { return s_.compare(0, x.s_.size(), x.s_) == 0; }
+  bool endsWith(const String &x) const {
+    return s_.size() >= x.s_.size() && s_.compare(s_.size() - x.s_.size(), x.s_.size(), x.s_) == 0;
+  }
+  int indexOf(char c) const {
+    size_t i = s_.find(c);
+    return i == std::string::npos ? -1 : (int)i;
+  }
+  int indexOf(const String &x) const {
+    size_t i = s_.find(x.s_);
+    return i == std::string::npos ? -1 : (int)i;
+  }
+  String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < s_.size() && to > from ? String(s_.substr(from, to - from)) : String();
+  }
+  char operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+
+  String &operator+=(const String &x) { s_ += x.s_; grow(); return *this; }
+  String &operator+=(const char *x) { s_ += x; grow(); return *this; }
+  String &operator+=(char c) { s_ += c; grow(); return *this; }
+  bool operator==(const String &x) const { return s_ == x.s_; }
+  bool operator==(const char *x) const { return s_ == x; }
+  bool operator!=(const String &x) const { return s_ != x.s_; }
+  bool operator!=(const char *x) const { return s_ != x; }
+
+  const std::string &str() const { return s_; }
+
+private:
+  void grow(void) {
+    if (s_.size() > SHIM_STRING_SSO && s_.size() > cap_) {
+      shim_string_bytes += s_.size() - cap_ + (cap_ ? 0 : 1);
+      cap_ = s_.size();
+      shim_string_allocs++;
+    }
+  }
+
+  std::string s_;
+  size_t cap_ = 0;      // 0 while it fits inside
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r += b; return r; }
+
+#endif
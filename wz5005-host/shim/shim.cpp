@@ -0,0 +1,569 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <vector>
+#include "Arduino.h"
+#include "FS.h"
+#include "ESP8266WiFi.h"
+#include "ESP8266WebServer.h"
+#include "ESP8266mDNS.h"
+#include "shim.hpp"
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+EspClass ESP;
+unsigned long shim_string_allocs = 0;
+long shim_string_bytes = 0;
+FS SPIFFS;
+ESP8266WiFiClass WiFi;
+MDNSResponder MDNS;
+
+static uint64_t now_us = 0;
+
+struct shim_event {
+  uint64_t when;
+  uint64_t seq;
+  std::function<void(void)> fn;
+  bool operator>(const shim_event &o) const {
+    return when != o.when ? when > o.when : seq > o.seq;
+  }
+};
+
+static std::priority_queue<shim_event, std::vector<shim_event>, std::greater<shim_event>> events;
+static uint64_t nextseq = 0;
+
+uint64_t shim_now(void) {
+  return now_us;
+}
+
+void shim_at(uint64_t when, std::function<void(void)> fn) {
+  events.push({ when < now_us ? now_us : when, nextseq++, fn });
+}
+
+void shim_advance(uint64_t us) {
+  uint64_t to = now_us + us;
+  while (!events.empty() && events.top().when <= to) {
+    shim_event e = events.top();
+    events.pop();
+    now_us = e.when;
+    e.fn();
+  }
+  now_us = to;
+}
+
+uint32_t EspClass::getCycleCount(void) {
+  static const auto start = std::chrono::steady_clock::now();
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  return (uint32_t)(now_us * SHIM_MHZ + ns * SHIM_MHZ / 1000);
+}
+
+// 32 bit like on the esp, so wrap around behaves the same
+unsigned long millis(void) {
+  return (uint32_t)(now_us / 1000);
+}
+
+unsigned long micros(void) {
+  return (uint32_t)now_us;
+}
+
+void delay(unsigned long ms) {
+  shim_advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+  shim_advance(us);
+}
+
+void yield(void) {
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void digitalWrite(uint8_t, uint8_t) {
+}
+
+// serial
+
+size_t HardwareSerial::print(long v, int base) {
+  char buf[24];
+  if (base == HEX) {
+    snprintf(buf, sizeof(buf), "%lX", (unsigned long)v);
+  } else {
+    snprintf(buf, sizeof(buf), "%ld", v);
+  }
+  return write(buf);
+}
+
+size_t HardwareSerial::print(unsigned long v, int base) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", v);
+  return write(buf);
+}
+
+// spiffs
+
+uint64_t shim_fs_read_bytes = 0;
+
+File FS::open(const char *path, const char *mode) {
+  auto it = files_.find(path);
+  if (mode[0] == 'r') {
+    if (it == files_.end()) {
+      return File();
+    }
+    return File(path, it->second, 0);
+  }
+  if (it == files_.end() || mode[0] == 'w') {
+    files_[path] = std::make_shared<std::vector<uint8_t>>();
+    it = files_.find(path);
+  }
+  return File(path, it->second, mode[0] == 'a' ? it->second->size() : 0);
+}
+
+bool FS::rename(const char *from, const char *to) {
+  auto it = files_.find(from);
+  if (it == files_.end() || files_.count(to)) {
+    return false;
+  }
+  files_[to] = it->second;
+  files_.erase(from);
+  return true;
+}
+
+Dir FS::openDir(const char *path) {
+  std::vector<std::pair<std::string, size_t>> e;
+  size_t n = strlen(path);
+  for (auto &f : files_) {
+    if (f.first.compare(0, n, path) == 0) {
+      e.push_back({ f.first, f.second->size() });
+    }
+  }
+  return Dir(e);
+}
+
+int shim_fs_load(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d) {
+    return -1;
+  }
+  int n = 0;
+  struct dirent *de;
+  while ((de = readdir(d))) {
+    std::string src = std::string(dir) + "/" + de->d_name;
+    struct stat st;
+    if (stat(src.c_str(), &st) || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    FILE *in = fopen(src.c_str(), "rb");
+    if (!in) {
+      continue;
+    }
+    File f = SPIFFS.open((std::string("/") + de->d_name).c_str(), "w");
+    uint8_t buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), in)) > 0) {
+      f.write(buf, got);
+    }
+    fclose(in);
+    n++;
+  }
+  closedir(d);
+  return n;
+}
+
+// tcp
+
+size_t shim_conn::room(void) {
+  size_t left = limit == (size_t)-1 ? 65536 : limit - out.size();
+  if (!rate) {
+    return left;
+  }
+  while (!unacked.empty() && unacked.front().first <= now_us) {
+    unacked.pop_front();
+  }
+  size_t held = 0;
+  for (auto &u : unacked) {
+    held += u.second;
+  }
+  return std::min(left, held < sndbuf ? sndbuf - held : 0);
+}
+
+size_t shim_conn::queue(const uint8_t *p, size_t n) {
+  n = std::min(n, room());
+  if (rate && n) {
+    free_at = std::max(free_at, now_us) + n * 1000000ULL / rate;
+    unacked.push_back({ free_at + rtt, n });
+  }
+  out.append((const char *)p, n);
+  return n;
+}
+
+bool shim_conn::gone(void) const {
+  return !open && now_us >= free_at + rtt;
+}
+
+static std::vector<WiFiServer *> listening;
+
+WiFiServer::~WiFiServer() {
+  listening.erase(std::remove(listening.begin(), listening.end(), this), listening.end());
+}
+
+void WiFiServer::begin(void) {
+  listening.push_back(this);
+}
+
+WiFiClient WiFiServer::accept(void) {
+  if (backlog_.empty()) {
+    return WiFiClient();
+  }
+  WiFiClient c(backlog_.front());
+  backlog_.pop_front();
+  c.setNoDelay(nodelay_);
+  return c;
+}
+
+bool shim_tcp_connect(uint16_t port, std::shared_ptr<shim_conn> conn) {
+  for (WiFiServer *s : listening) {
+    if (s->port_ == port) {
+      s->backlog_.push_back(conn);
+      return true;
+    }
+  }
+  return false;
+}
+
+// like ClientContext, waits for acks until it is all queued or the
+// timeout runs out. nothing else in the sketch runs meanwhile
+size_t WiFiClient::write(const uint8_t *p, size_t n) {
+  if (!connected()) {
+    return 0;
+  }
+  size_t done = c_->queue(p, n);
+  uint64_t give_up = now_us + WIFICLIENT_TIMEOUT * 1000ULL;
+  while (done < n && c_->rate && !c_->unacked.empty() && c_->unacked.front().first <= give_up) {
+    shim_advance(c_->unacked.front().first - now_us);
+    done += c_->queue(p + done, n - done);
+  }
+  return done;
+}
+
+// web server
+
+static const char *reason(int code) {
+  switch (code) {
+  case 200: return "OK";
+  case 204: return "No Content";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 409: return "Conflict";
+  case 500: return "Internal Server Error";
+  case 503: return "Service Unavailable";
+  default:  return "";
+  }
+}
+
+static int unhex(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static std::string urldecode(const std::string &s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '+') {
+      out += ' ';
+    } else if (s[i] == '%' && i + 2 < s.size() && unhex(s[i + 1]) >= 0 && unhex(s[i + 2]) >= 0) {
+      out += (char)(unhex(s[i + 1]) << 4 | unhex(s[i + 2]));
+      i += 2;
+    } else {
+      out += s[i];
+    }
+  }
+  return out;
+}
+
+static const String nothing;
+
+const String &ESP8266WebServer::arg(const String &name) {
+  for (size_t i = 0; i < args_.size(); i++) {
+    if (args_[i].first == name.str()) {
+      return argv_[i];
+    }
+  }
+  return nothing;
+}
+
+bool ESP8266WebServer::hasArg(const String &name) {
+  for (auto &a : args_) {
+    if (a.first == name.str()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const String &ESP8266WebServer::header(const String &name) {
+  for (size_t i = 0; i < headers_.size(); i++) {
+    if (strcasecmp(headers_[i].first.c_str(), name.c_str()) == 0) {
+      return headerv_[i];
+    }
+  }
+  return nothing;
+}
+
+bool ESP8266WebServer::hasHeader(const String &name) {
+  for (auto &h : headers_) {
+    if (strcasecmp(h.first.c_str(), name.c_str()) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ESP8266WebServer::sendHeader(const String &name, const String &value, bool first) {
+  if (first) {
+    out_headers_.insert(out_headers_.begin(), { name.str(), value.str() });
+  } else {
+    out_headers_.push_back({ name.str(), value.str() });
+  }
+}
+
+// status line and headers like the real one builds them, so the byte
+// counts the harness sees are the ones a browser would get
+void ESP8266WebServer::send(int code, const char *type, const String &content) {
+  send(code, type, (const uint8_t *)content.c_str(), content.length());
+}
+
+// the core builds them in a String a piece at a time, so does this so
+// shim_string_allocs sees what that costs
+void ESP8266WebServer::send(int code, const char *type, const uint8_t *content, size_t len) {
+  String h("HTTP/1.1 ");
+  h += String(code);
+  h += " ";
+  h += reason(code);
+  h += "\r\nContent-Type: ";
+  h += type ? type : "text/html";
+  if (length_ == CONTENT_LENGTH_UNKNOWN) {
+    chunked_ = true;
+    h += "\r\nTransfer-Encoding: chunked";
+  } else {
+    h += "\r\nContent-Length: ";
+    h += String((unsigned long)(length_ == CONTENT_LENGTH_NOT_SET ? len : length_));
+  }
+  h += "\r\n";
+  for (auto &x : out_headers_) {
+    h += x.first.c_str();
+    h += ": ";
+    h += x.second.c_str();
+    h += "\r\n";
+  }
+  h += "Connection: close\r\n\r\n";
+  out_headers_.clear();
+  client_.write((const uint8_t *)h.c_str(), h.length());
+  if (len) {
+    sendContent((const char *)content, len);
+  }
+}
+
+void ESP8266WebServer::sendContent(const char *content, size_t len) {
+  if (!chunked_) {
+    client_.write((const uint8_t *)content, len);
+    return;
+  }
+  char size[16];
+  snprintf(size, sizeof(size), "%zX\r\n", len);
+  client_.write(size);
+  client_.write((const uint8_t *)content, len);
+  client_.write("\r\n");
+  if (!len) {
+    chunked_ = false; // that was the last one
+  }
+}
+
+// like the core, a .gz goes out as itself with Content-Encoding: gzip
+size_t ESP8266WebServer::streamFile(File &file, const String &type) {
+  if (String(file.name()).endsWith(".gz") && type != "application/x-gzip" && type != "application/octet-stream") {
+    sendHeader("Content-Encoding", "gzip");
+  }
+  setContentLength(file.size());
+  send(200, type.c_str(), "");
+  uint8_t buf[1460];
+  size_t sent = 0;
+  int got;
+  while ((got = file.read(buf, sizeof(buf))) > 0) {
+    sent += client_.write(buf, got);
+  }
+  return sent;
+}
+
+const ESP8266WebServer::route *ESP8266WebServer::find(HTTPMethod method) {
+  for (auto &r : routes_) {
+    if (r.uri == path_ && (r.method == HTTP_ANY || r.method == method)) {
+      return &r;
+    }
+  }
+  return NULL;
+}
+
+void ESP8266WebServer::begin_request(HTTPMethod method, const char *uri, const shim_headers &headers,
+                                     std::shared_ptr<shim_conn> conn) {
+  method_ = method;
+  const char *q = strchr(uri, '?');
+  path_ = urldecode(q ? std::string(uri, q - uri) : std::string(uri));
+  uri_ = String(path_);
+  args_.clear();
+  argv_.clear();
+  if (q) {
+    std::string query(q + 1);
+    size_t at = 0;
+    while (at <= query.size()) {
+      size_t end = query.find('&', at);
+      if (end == std::string::npos) end = query.size();
+      std::string kv = query.substr(at, end - at);
+      size_t eq = kv.find('=');
+      if (!kv.empty()) {
+        args_.push_back({ urldecode(kv.substr(0, eq)), eq == std::string::npos ? "" : urldecode(kv.substr(eq + 1)) });
+        argv_.push_back(String(args_.back().second));
+      }
+      at = end + 1;
+    }
+  }
+  headers_ = headers;
+  headerv_.clear();
+  for (auto &h : headers_) {
+    headerv_.push_back(String(h.second));
+  }
+  out_headers_.clear();
+  length_ = CONTENT_LENGTH_NOT_SET;
+  chunked_ = false;
+  client_ = WiFiClient(conn);
+  last_ = conn;
+}
+
+void ESP8266WebServer::handle(void) {
+  const route *r = find(method_);
+  if (r) {
+    r->fn();
+  } else if (notfound_) {
+    notfound_();
+  } else {
+    send(404, "text/plain", "Not found");
+  }
+  // what the core does after every handler, a chunked reply gets its end
+  if (chunked_) {
+    sendContent("", 0);
+  }
+}
+
+static std::string dechunk(const std::string &in) {
+  std::string out;
+  size_t at = 0;
+  while (at < in.size()) {
+    size_t len = strtoul(in.c_str() + at, NULL, 16);
+    at = in.find("\r\n", at);
+    if (at == std::string::npos || len == 0) {
+      break;
+    }
+    out.append(in, at + 2, len);
+    at += 2 + len + 2;
+  }
+  return out;
+}
+
+int shim_response(const std::string &raw, std::string *body, shim_headers *reply) {
+  size_t end = raw.find("\r\n\r\n");
+  if (raw.compare(0, 9, "HTTP/1.1 ") || end == std::string::npos) {
+    return 0;
+  }
+  bool chunked = false;
+  size_t at = raw.find("\r\n") + 2;
+  while (at < end + 2) {
+    size_t eol = raw.find("\r\n", at);
+    std::string line = raw.substr(at, eol - at);
+    size_t colon = line.find(": ");
+    if (colon != std::string::npos) {
+      if (line.compare(0, colon, "Transfer-Encoding") == 0) {
+        chunked = true;
+      }
+      if (reply) {
+        reply->push_back({ line.substr(0, colon), line.substr(colon + 2) });
+      }
+    }
+    at = eol + 2;
+  }
+  if (body) {
+    std::string rest = raw.substr(end + 4);
+    *body = chunked ? dechunk(rest) : rest;
+  }
+  return atoi(raw.c_str() + 9);
+}
+
+// the server lets go of the client like the core does, a handler that
+// kept a copy (an /events listener, a download) keeps the connection and
+// everyone else is done with it
+int ESP8266WebServer::finish_request(std::string *body, shim_headers *reply) {
+  client_ = WiFiClient();
+  return shim_response(last_->out, body, reply);
+}
+
+int ESP8266WebServer::request(HTTPMethod method, const char *uri, std::string *body,
+                              const shim_headers &headers, shim_headers *reply) {
+  begin_request(method, uri, headers, std::make_shared<shim_conn>());
+  handle();
+  return finish_request(body, reply);
+}
+
+void ESP8266WebServer::connect(std::shared_ptr<shim_conn> conn, HTTPMethod method, const char *uri,
+                               const shim_headers &headers) {
+  queue_.push_back({ conn, method, uri, headers });
+}
+
+void ESP8266WebServer::handleClient(void) {
+  pcbs_.erase(std::remove_if(pcbs_.begin(), pcbs_.end(),
+                             [](const std::shared_ptr<shim_conn> &c) { return c->gone(); }), pcbs_.end());
+  if (queue_.empty() || pcbs_.size() >= SHIM_TCP_PCBS) {
+    return;
+  }
+  pending p = queue_.front();
+  queue_.pop_front();
+  pcbs_.push_back(p.conn);
+  begin_request(p.method, p.uri.c_str(), p.headers, p.conn);
+  handle();
+  finish_request(NULL, NULL);
+}
+
+int ESP8266WebServer::upload(const char *uri, const char *filename, const uint8_t *data, size_t len,
+                             std::string *body) {
+  begin_request(HTTP_POST, uri, shim_headers(), std::make_shared<shim_conn>());
+  const route *r = find(HTTP_POST);
+  if (!r) {
+    send(404, "text/plain", "Not found");
+    return finish_request(body, NULL);
+  }
+  upload_.filename = filename;
+  upload_.name = "file";
+  upload_.type = "application/octet-stream";
+  upload_.totalSize = 0;
+  upload_.currentSize = 0;
+  upload_.status = UPLOAD_FILE_START;
+  if (r->ufn) r->ufn();
+  for (size_t at = 0; at < len; at += HTTP_UPLOAD_BUFLEN) {
+    size_t n = len - at < HTTP_UPLOAD_BUFLEN ? len - at : HTTP_UPLOAD_BUFLEN;
+    memcpy(upload_.buf, data + at, n);
+    upload_.currentSize = n;
+    upload_.totalSize += n;
+    upload_.status = UPLOAD_FILE_WRITE;
+    if (r->ufn) r->ufn();
+  }
+  upload_.currentSize = 0;
+  upload_.status = UPLOAD_FILE_END;
+  if (r->ufn) r->ufn();
+  r->fn();
+  return finish_request(body, NULL);
+}
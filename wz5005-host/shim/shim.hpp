@@ -0,0 +1,23 @@
+#ifndef __SHIM__
+#define __SHIM__
+
+// harness side of the shims, things the sketch never calls
+
+#include <stdint.h>
+#include <functional>
+
+// virtual clock in us. millis()/micros() read it, delay() moves it on,
+// nothing else does unless the harness calls shim_advance()
+uint64_t shim_now(void);
+void shim_advance(uint64_t us);
+
+// run fn when the clock gets to when (us). events fire in time order, in
+// the order they were added when the times are equal, and the clock reads
+// exactly when while one runs, so a delay() in the sketch sees bytes
+// arrive part way thru it just like the real thing
+void shim_at(uint64_t when, std::function<void(void)> fn);
+
+// copy every file under dir into SPIFFS as /name
+int shim_fs_load(const char *dir);
+
+#endif
@@ -0,0 +1,117 @@
+// wz5005-sim - pretend to be a wz5005 on a pseudo terminal so the
+// firmware logic and the bens_scripts tools can be run without the real
+// supply on the bench
+//
+//   ./wz5005-sim [-l link] [-L load] [-b] [-e rate] [-E rate] [-d rate] [-s seed] [-v]
+//
+//   -l link   also make a symlink to the pty, eg -l /tmp/tty63
+//   -L load   open, short, r:OHMS or cc:AMPS (default r:10)
+//   -b        pace replies at 9600 baud instead of dumping them at once
+//   -e rate   chance a reply goes out with a broken checksum
+//   -E rate   chance a good request is treated as a bad checksum (0x90)
+//   -d rate   chance any single reply byte is dropped
+//   -s seed   seed for the above, same seed same run
+//   -v        hex dump traffic to stderr
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "psu.hpp"
+
+#define BYTE_US 1042        // 10 bits at 9600 baud
+
+static struct psu psu;
+static bool pace = false;
+static volatile sig_atomic_t quit = 0;
+
+static void emit(void *ctx, const uint8_t *p, size_t n) {
+  int fd = *(int *)ctx;
+  for (size_t i = 0; i < n; i++) {
+    if (write(fd, &p[i], 1) < 0 && errno != EAGAIN) return;
+    if (pace) usleep(BYTE_US);
+  }
+}
+
+static void on_signal(int) {
+  quit = 1;
+}
+
+int main(int argc, char **argv) {
+  const char *link = NULL;
+  int fd;
+  int opt;
+  psu_init(&psu, emit, &fd);
+  while ((opt = getopt(argc, argv, "l:L:be:E:d:s:v")) != -1) {
+    switch (opt) {
+    case 'l': link = optarg; break;
+    case 'L':
+      if (!psu_parse_load(&psu, optarg)) {
+        fprintf(stderr, "bad load %s, want open, short, r:OHMS or cc:AMPS\n", optarg);
+        return 1;
+      }
+      break;
+    case 'b': pace = true; break;
+    case 'e': psu.badreply = atof(optarg); break;
+    case 'E': psu.badrequest = atof(optarg); break;
+    case 'd': psu.dropbyte = atof(optarg); break;
+    case 's': psu.rng.seed(strtoul(optarg, NULL, 0)); break;
+    case 'v': psu.verbose = true; break;
+    default:
+      fprintf(stderr, "USAGE: wz5005-sim [-l link] [-L load] [-b] [-e rate] [-E rate] [-d rate] [-s seed] [-v]\n");
+      return 1;
+    }
+  }
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+    perror("posix_openpt");
+    return 1;
+  }
+  const char *name = ptsname(fd);
+
+  // raw 8n1 on the slave, and keep it open ourselves so the master
+  // doesnt see a hangup every time a client closes the tty
+  int slave = open(name, O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if (slave < 0 || tcgetattr(slave, &tio)) {
+    perror(name);
+    return 1;
+  }
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B9600);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  if (link) {
+    unlink(link);
+    if (symlink(name, link)) {
+      perror(link);
+      return 1;
+    }
+  }
+  printf("%s\n", name);
+  fflush(stdout);
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  while (!quit) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 200) <= 0) {
+      psu_rx_reset(&psu); // a frame that stalls this long is never getting finished
+      continue;
+    }
+    uint8_t c;
+    if (read(fd, &c, 1) == 1) psu_feed(&psu, c);
+  }
+
+  if (link) unlink(link);
+  close(slave);
+  close(fd);
+  return 0;
+}